@@ -74,6 +74,7 @@ extern const AVCodecParser ff_sbc_parser;
 extern const AVCodecParser ff_sipr_parser;
 extern const AVCodecParser ff_tak_parser;
 extern const AVCodecParser ff_vc1_parser;
+extern const AVCodecParser ff_vmix_parser;
 extern const AVCodecParser ff_vorbis_parser;
 extern const AVCodecParser ff_vp3_parser;
 extern const AVCodecParser ff_vp8_parser;
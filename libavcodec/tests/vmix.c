@@ -0,0 +1,445 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Decode synthetic VMX frames mixing DC only blocks and blocks with a few
+ * AC coefficients and check that
+ *  - DC only blocks are flat at every lowres level, i.e. no coefficients
+ *    leak from one block into the next,
+ *  - the packed output formats match the planar ones,
+ *  - keyed streams decode their alpha tables, coded here like luma,
+ *    output frames without them as opaque and reject frames whose alpha
+ *    tables do not end the frame,
+ *  - frames with a truncated slice are rejected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/dict.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/lfg.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+
+#include "libavcodec/avcodec.h"
+#include "libavcodec/put_bits.h"
+
+#define WIDTH     48
+#define HEIGHT    32
+#define NB_SLICES (HEIGHT / 16)
+#define NB_BLOCKS (2 * (WIDTH / 8 + 2 * WIDTH / 16))
+#define TABLE_MAX 1024
+
+typedef struct Block {
+    int dc;                     ///< absolute DC value
+    int ac[64];                 ///< quantised levels in zigzag order, ac[0] unused
+    int nb_ac;
+} Block;
+
+static Block blocks[NB_SLICES][NB_BLOCKS];
+
+static void put_ue(PutBitContext *pb, unsigned v)
+{
+    const int len = av_log2(v + 1);
+
+    put_bits(pb, len, 0);
+    put_bits(pb, len + 1, v + 1);
+}
+
+static void put_se(PutBitContext *pb, int v)
+{
+    put_ue(pb, v >= 0 ? 2 * v : -2 * v - 1);
+}
+
+static void put_block_ac(PutBitContext *pb, const Block *b)
+{
+    int n = 0;
+
+    for (int i = 1; i < 64; i++) {
+        if (!b->ac[i])
+            continue;
+        if (i > n) {
+            put_se(pb, 0);
+            put_ue(pb, i - n - 1);
+        }
+        put_se(pb, b->ac[i]);
+        n = i + 1;
+    }
+    if (n < 64) {
+        put_se(pb, 0);
+        put_ue(pb, 63 - n);
+    }
+}
+
+static void put_block_dc(PutBitContext *pb, int diff)
+{
+    put_se(pb, diff);
+    if (!diff)
+        put_ue(pb, 0);
+}
+
+static int put_table(uint8_t *dst, const uint8_t *src, int size)
+{
+    AV_WL32(dst, size);
+    memcpy(dst + 4, src, size);
+    return size + 4;
+}
+
+/**
+ * Make a frame with alpha tables which repeat the luma plane.
+ *
+ * @return size of the frame without the alpha tables
+ */
+static int make_packet(AVPacket *pkt, AVLFG *lfg)
+{
+    uint8_t dc_buf[NB_SLICES][TABLE_MAX], ac_buf[NB_SLICES][TABLE_MAX];
+    uint8_t dc_buf_a[NB_SLICES][TABLE_MAX], ac_buf_a[NB_SLICES][TABLE_MAX];
+    int dc_size[NB_SLICES], ac_size[NB_SLICES];
+    int dc_size_a[NB_SLICES], ac_size_a[NB_SLICES];
+    int ret, pos, size;
+
+    for (int s = 0; s < NB_SLICES; s++) {
+        PutBitContext dc_pb, ac_pb, dc_pb_a, ac_pb_a;
+        int b = 0;
+
+        init_put_bits(&dc_pb, dc_buf[s], TABLE_MAX);
+        init_put_bits(&ac_pb, ac_buf[s], TABLE_MAX);
+        init_put_bits(&dc_pb_a, dc_buf_a[s], TABLE_MAX);
+        init_put_bits(&ac_pb_a, ac_buf_a[s], TABLE_MAX);
+
+        for (int p = 0; p < 3; p++) {
+            const int nb = 2 * (p ? WIDTH / 16 : WIDTH / 8);
+            int prev_dc = 0;
+
+            for (int i = 0; i < nb; i++, b++) {
+                Block *blk = &blocks[s][b];
+
+                memset(blk, 0, sizeof(*blk));
+                /* 8-bit samples of about 28..228, coded around 1024 for chroma */
+                blk->dc = (int)(av_lfg_get(lfg) % 1601) - 800 + (p ? 1024 : 0);
+                if (av_lfg_get(lfg) & 1) {
+                    blk->nb_ac = 1 + av_lfg_get(lfg) % 4;
+                    for (int k = 0; k < blk->nb_ac; k++)
+                        blk->ac[1 + av_lfg_get(lfg) % 63] = (av_lfg_get(lfg) & 1) ? 2 : -2;
+                }
+
+                put_block_dc(&dc_pb, blk->dc - prev_dc);
+                put_block_ac(&ac_pb, blk);
+                if (!p) {
+                    put_block_dc(&dc_pb_a, blk->dc - prev_dc);
+                    put_block_ac(&ac_pb_a, blk);
+                }
+                prev_dc = blk->dc;
+            }
+            align_put_bits(&dc_pb);
+            align_put_bits(&ac_pb);
+        }
+        flush_put_bits(&dc_pb);
+        flush_put_bits(&ac_pb);
+        flush_put_bits(&dc_pb_a);
+        flush_put_bits(&ac_pb_a);
+        dc_size[s]   = put_bytes_output(&dc_pb);
+        ac_size[s]   = put_bytes_output(&ac_pb);
+        dc_size_a[s] = put_bytes_output(&dc_pb_a);
+        ac_size_a[s] = put_bytes_output(&ac_pb_a);
+    }
+
+    ret = av_new_packet(pkt, 3 + 16 * NB_SLICES + 4 * NB_SLICES * TABLE_MAX);
+    if (ret < 0)
+        return ret;
+
+    /* version 1 header with quality 90 */
+    pkt->data[0] = 1;
+    pkt->data[1] = 90;
+    pkt->data[2] = 0;
+    pos = 3;
+    for (int s = 0; s < NB_SLICES; s++)
+        pos += put_table(pkt->data + pos, dc_buf[s], dc_size[s]);
+    for (int s = 0; s < NB_SLICES; s++)
+        pos += put_table(pkt->data + pos, ac_buf[s], ac_size[s]);
+    size = pos;
+    for (int s = 0; s < NB_SLICES; s++)
+        pos += put_table(pkt->data + pos, dc_buf_a[s], dc_size_a[s]);
+    for (int s = 0; s < NB_SLICES; s++)
+        pos += put_table(pkt->data + pos, ac_buf_a[s], ac_size_a[s]);
+    av_shrink_packet(pkt, pos);
+    pkt->flags |= AV_PKT_FLAG_KEY;
+
+    return size;
+}
+
+/* Cut the AC table of the last slice of a frame without alpha in half. */
+static int truncate_slice(AVPacket *dst, const AVPacket *src)
+{
+    int pos = 3, size, ret;
+
+    for (int t = 0; t < 2 * NB_SLICES - 1; t++)
+        pos += 4 + AV_RL32(src->data + pos);
+    size = AV_RL32(src->data + pos) / 2;
+
+    ret = av_new_packet(dst, pos + 4 + size);
+    if (ret < 0)
+        return ret;
+    memcpy(dst->data, src->data, dst->size);
+    AV_WL32(dst->data + pos, size);
+    dst->flags |= AV_PKT_FLAG_KEY;
+
+    return 0;
+}
+
+static enum AVPixelFormat get_format(AVCodecContext *avctx,
+                                     const enum AVPixelFormat *fmts)
+{
+    const enum AVPixelFormat *wanted = avctx->opaque;
+
+    for (const enum AVPixelFormat *p = fmts; *p != AV_PIX_FMT_NONE; p++)
+        if (*p == *wanted)
+            return *p;
+    return AV_PIX_FMT_NONE;
+}
+
+static int decode(const AVPacket *pkt, AVFrame *frame, enum AVPixelFormat fmt,
+                  int bits, int alpha, int lowres)
+{
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_VMIX);
+    AVCodecContext *avctx = avcodec_alloc_context3(codec);
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if (!avctx)
+        return AVERROR(ENOMEM);
+
+    if (fmt == AV_PIX_FMT_UYVY422 || fmt == AV_PIX_FMT_P216) {
+        ret = av_dict_set(&opts, "packed", "1", 0);
+        if (ret < 0) {
+            avcodec_free_context(&avctx);
+            return ret;
+        }
+    }
+
+    avctx->width               = WIDTH;
+    avctx->height              = HEIGHT;
+    avctx->bits_per_raw_sample = bits;
+    avctx->bits_per_coded_sample = alpha ? 32 : 24;
+    avctx->lowres              = lowres;
+    avctx->opaque              = &fmt;
+    avctx->get_format          = get_format;
+
+    ret = avcodec_open2(avctx, codec, &opts);
+    av_dict_free(&opts);
+    if (ret >= 0)
+        ret = avcodec_send_packet(avctx, pkt);
+    if (ret >= 0)
+        ret = avcodec_receive_frame(avctx, frame);
+    if (ret >= 0 && frame->format != fmt)
+        ret = AVERROR_BUG;
+
+    avcodec_free_context(&avctx);
+    return ret;
+}
+
+static int sample(const AVFrame *frame, int plane, int x, int y)
+{
+    const uint8_t *row;
+
+    switch (frame->format) {
+    case AV_PIX_FMT_UYVY422:
+        row = frame->data[0] + y * frame->linesize[0];
+        return plane ? row[4 * x + 2 * (plane - 1)] : row[2 * x + 1];
+    case AV_PIX_FMT_P216:
+        row = frame->data[!!plane] + y * frame->linesize[!!plane];
+        return AV_RN16(row + 2 * (plane ? 2 * x + plane - 1 : x)) >> 6;
+    default:
+        row = frame->data[plane] + y * frame->linesize[plane];
+        return av_pix_fmt_desc_get(frame->format)->comp[0].depth == 8 ? row[x] :
+                                                                         AV_RN16(row + 2 * x);
+    }
+}
+
+/* Blocks without AC coefficients must be flat. */
+static int check_flat(const AVFrame *frame, int lowres)
+{
+    const int size = 8 >> lowres;
+
+    for (int s = 0; s < NB_SLICES; s++) {
+        int b = 0;
+
+        for (int p = 0; p < 3; p++) {
+            const int nb = p ? WIDTH / 16 : WIDTH / 8;
+
+            for (int by = 0; by < 2; by++) {
+                for (int bx = 0; bx < nb; bx++, b++) {
+                    const int x0 = bx * size, y0 = (s * 2 + by) * size;
+                    const int v  = sample(frame, p, x0, y0);
+
+                    if (blocks[s][b].nb_ac)
+                        continue;
+                    for (int y = 0; y < size; y++) {
+                        for (int x = 0; x < size; x++) {
+                            if (sample(frame, p, x0 + x, y0 + y) != v) {
+                                fprintf(stderr, "%s lowres %d: DC only block %d of "
+                                        "plane %d in slice %d is not flat\n",
+                                        av_get_pix_fmt_name(frame->format), lowres,
+                                        b, p, s);
+                                return 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int check_packed(const AVFrame *planar, const AVFrame *packed, int lowres)
+{
+    for (int p = 0; p < 3; p++) {
+        const int w = p ? AV_CEIL_RSHIFT(planar->width, 1) : planar->width;
+
+        for (int y = 0; y < planar->height; y++) {
+            for (int x = 0; x < w; x++) {
+                if (sample(planar, p, x, y) != sample(packed, p, x, y)) {
+                    fprintf(stderr, "%s lowres %d: plane %d differs at %d,%d\n",
+                            av_get_pix_fmt_name(packed->format), lowres, p, x, y);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int check_alpha(const AVFrame *frame, int opaque, int lowres)
+{
+    const int max = (1 << av_pix_fmt_desc_get(frame->format)->comp[3].depth) - 1;
+
+    for (int y = 0; y < frame->height; y++) {
+        for (int x = 0; x < frame->width; x++) {
+            const uint8_t *row = frame->data[3] + y * frame->linesize[3];
+            const int v = max > 255 ? AV_RN16(row + 2 * x) : row[x];
+
+            if (v != (opaque ? max : sample(frame, 0, x, y))) {
+                fprintf(stderr, "%s lowres %d: %s alpha differs at %d,%d\n",
+                        av_get_pix_fmt_name(frame->format), lowres,
+                        opaque ? "opaque" : "coded", x, y);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const struct {
+        int bits;
+        enum AVPixelFormat planar, packed, alpha;
+    } formats[] = {
+        {  8, AV_PIX_FMT_YUV422P,   AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUVA422P   },
+        { 10, AV_PIX_FMT_YUV422P10, AV_PIX_FMT_P216,    AV_PIX_FMT_YUVA422P10 },
+    };
+    AVPacket *pkt = av_packet_alloc();
+    AVPacket *pkt_noalpha = av_packet_alloc();
+    AVPacket *pkt_trunc = av_packet_alloc();
+    AVFrame *planar = av_frame_alloc();
+    AVFrame *packed = av_frame_alloc();
+    AVLFG lfg;
+    int ret = 0;
+
+    if (!pkt || !pkt_noalpha || !pkt_trunc || !planar || !packed) {
+        ret = 1;
+        goto end;
+    }
+
+    av_lfg_init(&lfg, 0xdeadbeef);
+
+    for (int i = 0; i < 4 && !ret; i++) {
+        const int size = make_packet(pkt, &lfg);
+
+        if (size < 0 || av_new_packet(pkt_noalpha, size) < 0) {
+            ret = 1;
+            break;
+        }
+        memcpy(pkt_noalpha->data, pkt->data, size);
+        if (truncate_slice(pkt_trunc, pkt_noalpha) < 0) {
+            ret = 1;
+            break;
+        }
+
+        for (int f = 0; f < FF_ARRAY_ELEMS(formats) && !ret; f++) {
+            const int bits = formats[f].bits;
+
+            for (int lowres = 0; lowres <= 3 && !ret; lowres++) {
+                /* the alpha tables are trailing data for unkeyed streams */
+                if (decode(pkt, planar, formats[f].planar, bits, 0, lowres) < 0 ||
+                    decode(pkt, packed, formats[f].packed, bits, 0, lowres) < 0) {
+                    fprintf(stderr, "Decoding failed\n");
+                    ret = 1;
+                    break;
+                }
+                ret = check_flat(planar, lowres) ||
+                      check_packed(planar, packed, lowres);
+                av_frame_unref(planar);
+                av_frame_unref(packed);
+                if (ret)
+                    break;
+
+                if (decode(pkt,         planar, formats[f].alpha, bits, 1, lowres) < 0 ||
+                    decode(pkt_noalpha, packed, formats[f].alpha, bits, 1, lowres) < 0) {
+                    fprintf(stderr, "Decoding failed\n");
+                    ret = 1;
+                    break;
+                }
+                ret = check_alpha(planar, 0, lowres) ||
+                      check_alpha(packed, 1, lowres);
+                av_frame_unref(planar);
+                av_frame_unref(packed);
+                if (ret)
+                    break;
+
+                pkt->size--;
+                if (decode(pkt, planar, formats[f].alpha, bits, 1, lowres) >= 0) {
+                    fprintf(stderr, "Truncated alpha tables were accepted\n");
+                    ret = 1;
+                }
+                pkt->size++;
+                av_frame_unref(planar);
+
+                if (!ret && decode(pkt_trunc, planar, formats[f].planar, bits, 0, lowres) >= 0) {
+                    fprintf(stderr, "A truncated slice was accepted\n");
+                    ret = 1;
+                }
+                av_frame_unref(planar);
+            }
+        }
+        av_packet_unref(pkt);
+        av_packet_unref(pkt_noalpha);
+        av_packet_unref(pkt_trunc);
+    }
+
+end:
+    av_packet_free(&pkt);
+    av_packet_free(&pkt_noalpha);
+    av_packet_free(&pkt_trunc);
+    av_frame_free(&planar);
+    av_frame_free(&packed);
+    return ret;
+}
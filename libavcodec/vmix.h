@@ -0,0 +1,60 @@
+/*
+ * vMix VMX common definitions
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVCODEC_VMIX_H
+#define AVCODEC_VMIX_H
+
+#include <stdint.h>
+
+#include "libavutil/attributes_internal.h"
+
+/* Header quality bytes below this use the finest quantiser. */
+#define VMIX_QUALITY_MIN 36
+#define VMIX_QUALITY_MAX 99
+
+/**
+ * Parse the header of a VMX frame: a byte giving the number of header
+ * bytes that follow, 1 for the quality byte alone or 3 for a DC shift,
+ * two further bytes and the quality byte.
+ *
+ * @param lshift  set to the DC shift, 0 if the header has none
+ * @param quality set to the quality byte
+ * @return offset of the first slice table or a negative value if buf
+ *         does not start with a valid header
+ */
+static inline int ff_vmix_parse_header(const uint8_t *buf, int buf_size,
+                                       int *lshift, int *quality)
+{
+    if (buf_size < 1 || (buf[0] != 1 && buf[0] != 3) || buf_size < 2 + buf[0])
+        return -1;
+
+    *lshift  = buf[0] == 3 ? buf[1] : 0;
+    *quality = buf[buf[0]];
+    return 2 + buf[0];
+}
+
+FF_VISIBILITY_PUSH_HIDDEN
+/** quantiser scale for each header quality byte */
+extern const uint8_t ff_vmix_quality[VMIX_QUALITY_MAX + 1];
+/** base quantisation matrix in natural order */
+extern const uint8_t ff_vmix_quant[64];
+FF_VISIBILITY_POP_HIDDEN
+
+#endif /* AVCODEC_VMIX_H */
@@ -0,0 +1,110 @@
+/*
+ * vMix VMX parser
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * vMix VMX parser
+ *
+ * VMX has no start codes and is always carried one frame per packet, so
+ * this parser does not split the input. It validates the frame layout
+ * and exports what can be derived from it: every frame is a keyframe.
+ *
+ * The slice tables cannot be walked without the frame height, which
+ * only the container provides: n slices with alpha tables are
+ * indistinguishable from 2n slices without. Like the bit depth, alpha
+ * is therefore taken from the container, which marks keyed streams with
+ * a depth of 32 bits, and only checked against the frame.
+ */
+
+#include "libavutil/intreadwrite.h"
+#include "libavutil/macros.h"
+#include "libavutil/pixfmt.h"
+
+#include "parser.h"
+#include "vmix.h"
+
+/**
+ * Skip nb_tables tables of nb_slices size prefixed slices.
+ *
+ * @return offset of the first byte after the tables or a negative value
+ *         if they do not fit into the buffer
+ */
+static int64_t skip_slice_tables(const uint8_t *buf, int buf_size,
+                                 int64_t offset, int nb_slices, int nb_tables)
+{
+    for (int n = 0; n < nb_slices * nb_tables; n++) {
+        if (buf_size - offset < 4)
+            return -1;
+        offset += 4 + (int64_t)AV_RL32(buf + offset);
+        if (offset > buf_size)
+            return -1;
+    }
+    return offset;
+}
+
+static int vmix_parse(AVCodecParserContext *s, AVCodecContext *avctx,
+                      const uint8_t **poutbuf, int *poutbuf_size,
+                      const uint8_t *buf, int buf_size)
+{
+    int64_t end;
+    int offset, nb_slices, alpha, lshift, quality;
+
+    *poutbuf      = buf;
+    *poutbuf_size = buf_size;
+
+    s->key_frame         = 1;
+    s->pict_type         = AV_PICTURE_TYPE_I;
+    s->picture_structure = AV_PICTURE_STRUCTURE_FRAME;
+
+    if (buf_size < 5 || avctx->height <= 0)
+        return buf_size;
+
+    offset = ff_vmix_parse_header(buf, buf_size, &lshift, &quality);
+    if (offset < 0)
+        return buf_size;
+
+    nb_slices = (avctx->height + 15) / 16;
+    end = skip_slice_tables(buf, buf_size, offset, nb_slices, 2);
+    if (end < 0)
+        return buf_size;
+
+    /* As in the decoder, alpha tables have to end the frame and
+     * anything following the tables of unkeyed streams is ignored. */
+    alpha = avctx->bits_per_coded_sample == 32;
+    if (alpha && end < buf_size &&
+        skip_slice_tables(buf, buf_size, end, nb_slices, 2) != buf_size)
+        return buf_size;
+
+    s->width        = avctx->width;
+    s->height       = avctx->height;
+    s->coded_width  = FFALIGN(avctx->width, 16);
+    s->coded_height = nb_slices * 16;
+    if (avctx->bits_per_raw_sample > 8)
+        s->format = alpha ? AV_PIX_FMT_YUVA422P10 : AV_PIX_FMT_YUV422P10;
+    else
+        s->format = alpha ? AV_PIX_FMT_YUVA422P : AV_PIX_FMT_YUV422P;
+
+    return buf_size;
+}
+
+const AVCodecParser ff_vmix_parser = {
+    .codec_ids    = { AV_CODEC_ID_VMIX },
+    .parser_parse = vmix_parse,
+};
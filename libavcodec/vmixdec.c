@@ -23,28 +23,69 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "libavutil/dict.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mem.h"
 #include "libavutil/mem_internal.h"
+#include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "libavutil/video_enc_params.h"
 
 #include "avcodec.h"
 #include "codec_internal.h"
+#include "decode.h"
 #define CACHED_BITSTREAM_READER !ARCH_X86_32
 #include "golomb.h"
 #include "get_bits.h"
 #include "idctdsp.h"
+#include "simple_idct.h"
 #include "thread.h"
+#include "vmix.h"
+
+#define AC_MULTI_BITS 10
+#define AC_MULTI_MAX  (AC_MULTI_BITS / 2)
+
+/**
+ * Up to AC_MULTI_MAX AC events fully contained in the next
+ * AC_MULTI_BITS bits of the stream. An event is either a nonzero
+ * level or a zero level followed by its run of further zeros.
+ */
+typedef struct ACMultiSymbol {
+    uint8_t nb;                 ///< number of complete events
+    uint8_t len[AC_MULTI_MAX];  ///< bits consumed up to and including event i
+    int8_t  level[AC_MULTI_MAX];
+    uint8_t run[AC_MULTI_MAX];
+} ACMultiSymbol;
+
+static ACMultiSymbol ac_multi[1 << AC_MULTI_BITS];
+
+enum SliceTable {
+    TABLE_DC,
+    TABLE_AC,
+    TABLE_ALPHA_DC,
+    TABLE_ALPHA_AC,
+    NB_TABLES,
+};
 
 typedef struct SliceContext {
-    const uint8_t *dc_ptr;
-    const uint8_t *ac_ptr;
-    unsigned dc_size;
-    unsigned ac_size;
+    const uint8_t *ptr[NB_TABLES];
+    unsigned size[NB_TABLES];
+    int ret;                    ///< result of decoding the slice
 } SliceContext;
 
 typedef struct VMIXContext {
+    const AVClass *class;
+    int export_stats;           ///< export quality and slice sizes as metadata
+    int output_packed;          ///< offer UYVY422/P216 instead of planar output
+
+    int width, height;          ///< coded picture size, before lowres
+    int lowres;
     int nb_slices;
     int lshift;
+    int pixel_shift;
+    int alpha;                  ///< output has an alpha plane
+    int alpha_tables;           ///< the current frame codes its alpha plane
+    int packed;
 
     int16_t factors[64];
     uint8_t scan[64];
@@ -52,46 +93,144 @@ typedef struct VMIXContext {
     SliceContext *slices;
     unsigned int slices_size;
 
+    /* per thread planar slice, for packed output formats */
+    uint8_t *scratch;
+    unsigned int scratch_size;
+    ptrdiff_t scratch_linesize;
+
     IDCTDSPContext idsp;
 } VMIXContext;
 
-static const uint8_t quality[] = {
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    1, 1, 1, 1, 1, 1,64,63,62,61,
-   60,59,58,57,56,55,54,53,52,51,
-   50,49,48,47,46,45,44,43,42,41,
-   40,39,38,37,36,35,34,33,32,31,
-   30,29,28,27,26,25,24,23,22,21,
-   20,19,18,17,16,15,14,13,12,11,
-   10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+/* Parse an Exp-Golomb code at bit pos of a AC_MULTI_BITS wide code,
+ * return its length or 0 if it does not fit. */
+static av_cold int multi_ue(unsigned code, int pos, unsigned *val)
+{
+    int zeros = 0;
+
+    while (pos + zeros < AC_MULTI_BITS &&
+           !(code & (1 << (AC_MULTI_BITS - 1 - pos - zeros))))
+        zeros++;
+    if (pos + 2 * zeros + 1 > AC_MULTI_BITS)
+        return 0;
+
+    *val = ((code >> (AC_MULTI_BITS - pos - 2 * zeros - 1)) &
+            ((2 << zeros) - 1)) - 1;
+    return 2 * zeros + 1;
+}
+
+static av_cold void init_ac_multi(void)
+{
+    for (unsigned code = 0; code < FF_ARRAY_ELEMS(ac_multi); code++) {
+        ACMultiSymbol *e = &ac_multi[code];
+        int pos = 0;
+
+        while (e->nb < AC_MULTI_MAX) {
+            unsigned val, run = 0;
+            int len, level;
+
+            len = multi_ue(code, pos, &val);
+            if (!len)
+                break;
+            level = (val & 1) ? -(int)(val >> 1) - 1 : val >> 1;
+            if (!level) {
+                int run_len = multi_ue(code, pos + len, &run);
+                if (!run_len)
+                    break;
+                len += run_len;
+            }
+            pos += len;
+            e->len[e->nb]   = pos;
+            e->level[e->nb] = level;
+            e->run[e->nb]   = run;
+            e->nb++;
+        }
+    }
+}
+
+static const enum AVPixelFormat pix_fmts[] = {
+    AV_PIX_FMT_YUV422P,
+    AV_PIX_FMT_NONE
+};
+
+static const enum AVPixelFormat pix_fmts_10[] = {
+    AV_PIX_FMT_YUV422P10,
+    AV_PIX_FMT_NONE
+};
+
+/* Only offered when requested, so that every caller defaults to planar. */
+static const enum AVPixelFormat pix_fmts_packed[] = {
+    AV_PIX_FMT_UYVY422,
+    AV_PIX_FMT_NONE
+};
+
+static const enum AVPixelFormat pix_fmts_packed_10[] = {
+    AV_PIX_FMT_P216,
+    AV_PIX_FMT_NONE
 };
 
-static const uint8_t quant[64] = {
-    16, 16, 19, 22, 22, 26, 26, 27,
-    16, 16, 22, 22, 26, 27, 27, 29,
-    19, 22, 26, 26, 27, 29, 29, 35,
-    22, 24, 27, 27, 29, 32, 34, 38,
-    26, 27, 29, 29, 32, 35, 38, 46,
-    27, 29, 34, 34, 35, 40, 46, 56,
-    29, 34, 34, 37, 40, 48, 56, 69,
-    34, 37, 38, 40, 48, 58, 69, 83,
+static const enum AVPixelFormat pix_fmts_alpha[] = {
+    AV_PIX_FMT_YUVA422P,
+    AV_PIX_FMT_NONE
 };
 
+static const enum AVPixelFormat pix_fmts_alpha_10[] = {
+    AV_PIX_FMT_YUVA422P10,
+    AV_PIX_FMT_NONE
+};
+
+static int get_format(AVCodecContext *avctx, int alpha)
+{
+    VMIXContext *s = avctx->priv_data;
+    const enum AVPixelFormat *fmts;
+    int ret;
+
+    if (alpha)
+        fmts = s->pixel_shift ? pix_fmts_alpha_10  : pix_fmts_alpha;
+    else if (s->output_packed)
+        fmts = s->pixel_shift ? pix_fmts_packed_10 : pix_fmts_packed;
+    else
+        fmts = s->pixel_shift ? pix_fmts_10        : pix_fmts;
+
+    ret = ff_get_format(avctx, fmts);
+    if (ret < 0)
+        return ret;
+
+    avctx->pix_fmt = ret;
+    s->alpha  = alpha;
+    s->packed = ret == AV_PIX_FMT_UYVY422 || ret == AV_PIX_FMT_P216;
+    return 0;
+}
+
 static av_cold int decode_init(AVCodecContext *avctx)
 {
+    static AVOnce init_static_once = AV_ONCE_INIT;
     VMIXContext *s = avctx->priv_data;
+    int ret;
+
+    /* High bit depth streams can only be told apart by the container,
+     * e.g. the OMTVideoFlags_HighBitDepth frame flag. */
+    avctx->bits_per_raw_sample = avctx->bits_per_raw_sample > 8 ? 10 : 8;
+    s->pixel_shift = avctx->bits_per_raw_sample > 8;
+
+    /* So can keyed ones, e.g. by a 32-bit depth in MOV or AVI or the
+     * OMTVideoFlags_Alpha frame flag. The output format is negotiated
+     * once here; frames without alpha tables are output opaque. */
+    ret = get_format(avctx, avctx->bits_per_coded_sample == 32);
+    if (ret < 0)
+        return ret;
 
-    avctx->bits_per_raw_sample = 8;
-    avctx->pix_fmt = AV_PIX_FMT_YUV422P;
+    /* avcodec_open2() has already reduced width/height for lowres. */
+    s->width  = avctx->coded_width;
+    s->height = avctx->coded_height;
+    s->lowres = avctx->lowres;
 
-    avctx->coded_width = FFALIGN(avctx->width, 16);
-    avctx->coded_height = FFALIGN(avctx->height, 16);
+    avctx->coded_width = FFALIGN(s->width, 16);
+    avctx->coded_height = FFALIGN(s->height, 16);
 
     ff_idctdsp_init(&s->idsp, avctx);
     ff_permute_scantable(s->scan, ff_zigzag_direct,
                          s->idsp.idct_permutation);
+    ff_thread_once(&init_static_once, init_ac_multi);
     return 0;
 }
 
@@ -102,25 +241,60 @@ static inline int get_se_golomb_vmix(GetBitContext *gb)
     return ((buf >> 1) ^ (~sign));
 }
 
+/* The lowres IDCTs of IDCTDSPContext only output 8 bits, so high bit
+ * depth blocks are transformed at full size and averaged down. */
+static av_always_inline void idct_put_lowres_hbd_internal(uint8_t *dst, ptrdiff_t linesize,
+                                                          int16_t *block, int lowres)
+{
+    LOCAL_ALIGNED_16(uint16_t, tmp, [64]);
+    const int size = 8 >> lowres;
+
+    ff_simple_idct_put_int16_10bit((uint8_t *)tmp, 8 * sizeof(*tmp), block);
+
+    for (int y = 0; y < size; y++, dst += linesize) {
+        for (int x = 0; x < size; x++) {
+            const uint16_t *src = tmp + ((y * 8 + x) << lowres);
+            unsigned sum = 0;
+
+            for (int j = 0; j < 1 << lowres; j++)
+                for (int i = 0; i < 1 << lowres; i++)
+                    sum += src[j * 8 + i];
+            AV_WN16(dst + 2 * x, (sum + (1 << 2 * lowres >> 1)) >> 2 * lowres);
+        }
+    }
+}
+
+static void idct_put_lowres_hbd(uint8_t *dst, ptrdiff_t linesize,
+                                int16_t *block, int lowres)
+{
+    switch (lowres) {
+    case 1: idct_put_lowres_hbd_internal(dst, linesize, block, 1); break;
+    case 2: idct_put_lowres_hbd_internal(dst, linesize, block, 2); break;
+    case 3: idct_put_lowres_hbd_internal(dst, linesize, block, 3); break;
+    }
+}
+
 static int decode_dcac(AVCodecContext *avctx,
                        GetBitContext *dc_gb, GetBitContext *ac_gb,
                        unsigned *dcrun, unsigned *acrun,
-                       AVFrame *frame, int width, int by, int plane)
+                       uint8_t *dst, ptrdiff_t linesize, int width, int add)
 {
-    const ptrdiff_t linesize = frame->linesize[plane];
-    uint8_t *dst = frame->data[plane] + by * linesize;
     unsigned dc_run = *dcrun, ac_run = *acrun;
     LOCAL_ALIGNED_32(int16_t, block, [64]);
     VMIXContext *s = avctx->priv_data;
     const int16_t *factors = s->factors;
     const uint8_t *scan = s->scan;
-    const int add = plane ? 0 : 1024;
-    int i, dc_v = 0, ac_v = 0, dc = 0;
+    const int pixel_shift = s->pixel_shift;
+    const int lowres = s->lowres;
+    int dc_v = 0, ac_v = 0, dc = 0;
     const int lshift = s->lshift;
 
+    memset(block, 0, sizeof(*block)*64);
+
     for (int y = 0; y < 2; y++) {
         for (int x = 0; x < width; x += 8) {
-            memset(block, 0, sizeof(*block)*64);
+            uint8_t *ptr = dst + ((x >> lowres) << pixel_shift);
+            int n = FFMIN(ac_run, 64);
 
             if (dc_run > 0) {
                 dc_run--;
@@ -133,26 +307,63 @@ static int decode_dcac(AVCodecContext *avctx,
                     dc_run = get_ue_golomb_long(dc_gb);
             }
 
-            for (int n = 0; n < 64; n++) {
-                if (ac_run > 0) {
-                    ac_run--;
-                    continue;
-                }
+            ac_run -= n;
+
+            /* The coefficient at n == 0 is replaced by the DC. Every
+             * lookup starts at least one symbol, so there has to be data
+             * left before each one. */
+            while (n < 64) {
+                const ACMultiSymbol *e;
+                unsigned run;
+                int len = 0;
 
                 if (get_bits_left(ac_gb) < 1)
                     return AVERROR_INVALIDDATA;
-                ac_v = get_se_golomb_vmix(ac_gb);
-                i = scan[n];
-                block[i] = ((unsigned)ac_v * factors[i]) >> 4;
-                if (!ac_v)
-                    ac_run = get_ue_golomb_long(ac_gb);
+                e = &ac_multi[show_bits(ac_gb, AC_MULTI_BITS)];
+                if (!e->nb) {
+                    ac_v = get_se_golomb_vmix(ac_gb);
+                    if (ac_v) {
+                        if (n) {
+                            const int i = scan[n];
+                            block[i] = ((unsigned)ac_v * factors[i]) >> 4;
+                        }
+                        n++;
+                        continue;
+                    }
+                    run = get_ue_golomb_long(ac_gb);
+                    n++;
+                    ac_run = run - FFMIN(run, 64 - n);
+                    n += run - ac_run;
+                    continue;
+                }
+
+                for (int k = 0; k < e->nb && n < 64; k++) {
+                    if (e->level[k]) {
+                        if (n) {
+                            const int i = scan[n];
+                            block[i] = ((unsigned)e->level[k] * factors[i]) >> 4;
+                        }
+                        n++;
+                    } else {
+                        n++;
+                        run = FFMIN(e->run[k], 64 - n);
+                        ac_run = e->run[k] - run;
+                        n += run;
+                    }
+                    len = e->len[k];
+                }
+                skip_bits(ac_gb, len);
             }
 
             block[0] = ((unsigned)dc << lshift) + (unsigned)add;
-            s->idsp.idct_put(dst + x, linesize, block);
+            if (lowres && pixel_shift)
+                idct_put_lowres_hbd(ptr, linesize, block, lowres);
+            else
+                s->idsp.idct_put(ptr, linesize, block);
+            memset(block, 0, sizeof(*block)*64);
         }
 
-        dst += 8 * linesize;
+        dst += (8 >> lowres) * linesize;
     }
 
     *dcrun = dc_run;
@@ -161,28 +372,28 @@ static int decode_dcac(AVCodecContext *avctx,
     return 0;
 }
 
-static int decode_slice(AVCodecContext *avctx, AVFrame *frame,
-                        const uint8_t *dc_src, unsigned dc_slice_size,
-                        const uint8_t *ac_src, unsigned ac_slice_size,
-                        int by)
+static int decode_planes(AVCodecContext *avctx,
+                         const uint8_t *dc_src, unsigned dc_size,
+                         const uint8_t *ac_src, unsigned ac_size,
+                         uint8_t *const dst[], const ptrdiff_t linesize[],
+                         const int width[], const int add[], int nb_planes)
 {
     unsigned dc_run = 0, ac_run = 0;
     GetBitContext dc_gb, ac_gb;
     int ret;
 
-    ret = init_get_bits8(&dc_gb, dc_src, dc_slice_size);
+    ret = init_get_bits8(&dc_gb, dc_src, dc_size);
     if (ret < 0)
         return ret;
 
-    ret = init_get_bits8(&ac_gb, ac_src, ac_slice_size);
+    ret = init_get_bits8(&ac_gb, ac_src, ac_size);
     if (ret < 0)
         return ret;
 
-    for (int p = 0; p < 3; p++) {
-        const int rshift = !!p;
+    for (int p = 0; p < nb_planes; p++) {
         ret = decode_dcac(avctx, &dc_gb, &ac_gb,
-                          &dc_run, &ac_run, frame,
-                          frame->width >> rshift, by, p);
+                          &dc_run, &ac_run, dst[p], linesize[p],
+                          width[p], add[p]);
         if (ret < 0)
             return ret;
 
@@ -203,91 +414,320 @@ static int decode_slice(AVCodecContext *avctx, AVFrame *frame,
     return 0;
 }
 
-static int decode_slices(AVCodecContext *avctx, void *arg,
-                         int n, int thread_nb)
+static void fill_opaque(uint8_t *dst, ptrdiff_t linesize, int width, int height,
+                        int pixel_shift)
 {
-    VMIXContext *s = avctx->priv_data;
-    const uint8_t *dc_slice_ptr = s->slices[n].dc_ptr;
-    const uint8_t *ac_slice_ptr = s->slices[n].ac_ptr;
-    unsigned dc_slice_size = s->slices[n].dc_size;
-    unsigned ac_slice_size = s->slices[n].ac_size;
-    AVFrame *frame = arg;
+    for (int j = 0; j < height; j++, dst += linesize) {
+        if (pixel_shift) {
+            for (int i = 0; i < width; i++)
+                AV_WN16(dst + 2 * i, 1023);
+        } else {
+            memset(dst, 255, width);
+        }
+    }
+}
 
-    return decode_slice(avctx, frame, dc_slice_ptr, dc_slice_size,
-                        ac_slice_ptr, ac_slice_size, n * 16);
+static void pack_uyvy(uint8_t *dst, ptrdiff_t linesize,
+                      const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                      ptrdiff_t ylinesize, ptrdiff_t clinesize,
+                      int width, int height)
+{
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            dst[4 * i + 0] = u[i];
+            dst[4 * i + 1] = y[2 * i];
+            dst[4 * i + 2] = v[i];
+            dst[4 * i + 3] = y[2 * i + 1];
+        }
+        dst += linesize;
+        y   += ylinesize;
+        u   += clinesize;
+        v   += clinesize;
+    }
 }
 
-static int decode_frame(AVCodecContext *avctx,
-                        AVFrame *frame, int *got_frame,
-                        AVPacket *avpkt)
+static void pack_p216(uint8_t *dst_y, ptrdiff_t y_linesize,
+                      uint8_t *dst_uv, ptrdiff_t uv_linesize,
+                      const uint8_t *y_, const uint8_t *u_, const uint8_t *v_,
+                      ptrdiff_t ylinesize, ptrdiff_t clinesize,
+                      int width, int height)
+{
+    for (int j = 0; j < height; j++) {
+        const uint16_t *y = (const uint16_t *)(y_ + j * ylinesize);
+        const uint16_t *u = (const uint16_t *)(u_ + j * clinesize);
+        const uint16_t *v = (const uint16_t *)(v_ + j * clinesize);
+        uint16_t *dy  = (uint16_t *)(dst_y  + j * y_linesize);
+        uint16_t *duv = (uint16_t *)(dst_uv + j * uv_linesize);
+
+        for (int i = 0; i < width; i++) {
+            dy[2 * i]      = y[2 * i]     << 6 | y[2 * i]     >> 4;
+            dy[2 * i + 1]  = y[2 * i + 1] << 6 | y[2 * i + 1] >> 4;
+            duv[2 * i]     = u[i] << 6 | u[i] >> 4;
+            duv[2 * i + 1] = v[i] << 6 | v[i] >> 4;
+        }
+    }
+}
+
+/* Slices are reported as soon as they are complete, which with slice
+ * threads means from the worker threads and possibly out of order, as
+ * permitted for draw_horiz_band(). */
+static void draw_slice(AVCodecContext *avctx, const AVFrame *frame,
+                       int y, int height)
+{
+    int offset[AV_NUM_DATA_POINTERS] = { 0 };
+
+    for (int p = 0; p < AV_NUM_DATA_POINTERS && frame->data[p]; p++)
+        offset[p] = frame->linesize[p] * y;
+
+    avctx->draw_horiz_band(avctx, frame, offset, y, 3, height);
+}
+
+static int decode_slice(AVCodecContext *avctx, AVFrame *frame,
+                        const SliceContext *sl, int by, int thread_nb)
 {
     VMIXContext *s = avctx->priv_data;
-    unsigned offset, q;
+    const int luma_add = 1024 << 2 * s->pixel_shift;
+    const int width[3] = { s->width, s->width >> 1, s->width >> 1 };
+    const int height = FFMIN(16 >> s->lowres, frame->height - by);
+    const int add[3] = { luma_add, 0, 0 };
+    uint8_t *dst[3];
+    ptrdiff_t linesize[3];
     int ret;
 
-    if (avpkt->size <= 7)
-        return AVERROR_INVALIDDATA;
+    if (s->packed) {
+        /* Decode into a planar slice and pack it while it is in cache. */
+        dst[0] = s->scratch + thread_nb * s->scratch_linesize * 32;
+        dst[1] = dst[0] + s->scratch_linesize * (16 >> s->lowres);
+        dst[2] = dst[1] + s->scratch_linesize / 2;
+        linesize[0] = s->scratch_linesize;
+        linesize[1] = linesize[2] = s->scratch_linesize;
+    } else {
+        for (int p = 0; p < 3; p++) {
+            linesize[p] = frame->linesize[p];
+            dst[p] = frame->data[p] + by * linesize[p];
+        }
+    }
 
-    s->lshift = 0;
-    offset = 2 + avpkt->data[0];
-    if (offset == 5)
-        s->lshift = avpkt->data[1];
-    else if (offset != 3)
-        return AVERROR_INVALIDDATA;
+    ret = decode_planes(avctx, sl->ptr[TABLE_DC], sl->size[TABLE_DC],
+                        sl->ptr[TABLE_AC], sl->size[TABLE_AC],
+                        dst, linesize, width, add, 3);
+    if (ret < 0)
+        return ret;
 
-    if (s->lshift > 31)
-        return AVERROR_INVALIDDATA;
+    if (s->alpha) {
+        const ptrdiff_t linesize_a = frame->linesize[3];
+        uint8_t *dst_a = frame->data[3] + by * linesize_a;
+
+        if (s->alpha_tables) {
+            ret = decode_planes(avctx, sl->ptr[TABLE_ALPHA_DC], sl->size[TABLE_ALPHA_DC],
+                                sl->ptr[TABLE_ALPHA_AC], sl->size[TABLE_ALPHA_AC],
+                                &dst_a, &linesize_a, width, add, 1);
+            if (ret < 0)
+                return ret;
+        } else {
+            fill_opaque(dst_a, linesize_a, frame->width, height, s->pixel_shift);
+        }
+    }
 
-    q = quality[FFMIN(avpkt->data[offset - 2], FF_ARRAY_ELEMS(quality)-1)];
-    for (int n = 0; n < 64; n++)
-        s->factors[n] = quant[n] * q;
+    if (avctx->pix_fmt == AV_PIX_FMT_UYVY422)
+        pack_uyvy(frame->data[0] + by * frame->linesize[0],
+                         frame->linesize[0], dst[0], dst[1], dst[2],
+                         linesize[0], linesize[1], (frame->width + 1) >> 1, height);
+    else if (avctx->pix_fmt == AV_PIX_FMT_P216)
+        pack_p216(frame->data[0] + by * frame->linesize[0], frame->linesize[0],
+                         frame->data[1] + by * frame->linesize[1], frame->linesize[1],
+                         dst[0], dst[1], dst[2], linesize[0], linesize[1],
+                         (frame->width + 1) >> 1, height);
 
-    s->nb_slices = (avctx->height + 15) / 16;
-    av_fast_mallocz(&s->slices, &s->slices_size, s->nb_slices * sizeof(*s->slices));
-    if (!s->slices)
-        return AVERROR(ENOMEM);
+    if (avctx->draw_horiz_band)
+        draw_slice(avctx, frame, by, height);
+
+    return 0;
+}
+
+static int decode_slices(AVCodecContext *avctx, void *arg,
+                         int n, int thread_nb)
+{
+    VMIXContext *s = avctx->priv_data;
+    AVFrame *frame = arg;
+
+    SliceContext *sl = &s->slices[n];
+
+    sl->ret = decode_slice(avctx, frame, sl, (n * 16) >> s->lowres, thread_nb);
+    return sl->ret;
+}
 
+/**
+ * Read one size table of nb_slices entries, each followed by its data.
+ */
+static int parse_slice_table(VMIXContext *s, const AVPacket *avpkt,
+                             unsigned *offset, enum SliceTable table)
+{
     for (int n = 0; n < s->nb_slices; n++) {
         unsigned slice_size;
 
-        if (offset + 4 > avpkt->size)
+        if (*offset + 4 > avpkt->size)
             return AVERROR_INVALIDDATA;
 
-        slice_size = AV_RL32(avpkt->data + offset);
+        slice_size = AV_RL32(avpkt->data + *offset);
         if (slice_size > avpkt->size)
             return AVERROR_INVALIDDATA;
 
-        if (avpkt->size - slice_size - 4LL < offset)
+        if (avpkt->size - slice_size - 4LL < *offset)
             return AVERROR_INVALIDDATA;
 
-        s->slices[n].dc_size = slice_size;
-        s->slices[n].dc_ptr = avpkt->data + offset + 4;
-        offset += slice_size + 4;
+        s->slices[n].size[table] = slice_size;
+        s->slices[n].ptr[table]  = avpkt->data + *offset + 4;
+        *offset += slice_size + 4;
     }
 
+    return 0;
+}
+
+/* Every slice is coded with the frame's quantiser. */
+static int export_enc_params(AVCodecContext *avctx, AVFrame *frame, int q)
+{
+    VMIXContext *s = avctx->priv_data;
+    AVVideoEncParams *par;
+
+    par = av_video_enc_params_create_side_data(frame, AV_VIDEO_ENC_PARAMS_MPEG2,
+                                               s->nb_slices);
+    if (!par)
+        return AVERROR(ENOMEM);
+
+    par->qp = q;
     for (int n = 0; n < s->nb_slices; n++) {
-        unsigned slice_size;
+        AVVideoBlockParams *b = av_video_enc_params_block(par, n);
 
-        if (offset + 4 > avpkt->size)
-            return AVERROR_INVALIDDATA;
+        b->src_x = 0;
+        b->src_y = n * 16;
+        b->w     = s->width;
+        b->h     = FFMIN(16, s->height - n * 16);
+    }
 
-        slice_size = AV_RL32(avpkt->data + offset);
-        if (slice_size > avpkt->size)
-            return AVERROR_INVALIDDATA;
+    return 0;
+}
+
+/**
+ * Export the frame's quality and the coded size of its slices, so the
+ * bitrate of recorded or received streams can be analysed, e.g. with
+ * ffprobe -export_stats 1 -show_frames.
+ */
+static int export_stats(AVCodecContext *avctx, AVFrame *frame,
+                        int quality_level, int q)
+{
+    VMIXContext *s = avctx->priv_data;
+    int64_t bytes[NB_TABLES] = { 0 };
+    int64_t total = 0, slice_min = INT64_MAX, slice_max = 0;
+    int ret;
 
-        if (avpkt->size - slice_size - 4LL < offset)
+    for (int n = 0; n < s->nb_slices; n++) {
+        const SliceContext *sl = &s->slices[n];
+        int64_t slice_bytes = 0;
+
+        for (int t = 0; t < (s->alpha_tables ? NB_TABLES : TABLE_ALPHA_DC); t++) {
+            bytes[t]    += sl->size[t];
+            slice_bytes += sl->size[t];
+        }
+        total    += slice_bytes;
+        slice_min = FFMIN(slice_min, slice_bytes);
+        slice_max = FFMAX(slice_max, slice_bytes);
+    }
+
+#define SET(key, value)                                                   \
+    do {                                                                  \
+        ret = av_dict_set_int(&frame->metadata, "vmix." key, value, 0);   \
+        if (ret < 0)                                                      \
+            return ret;                                                   \
+    } while (0)
+
+    SET("quality",        quality_level);
+    SET("quantizer",      q);
+    SET("slices",         s->nb_slices);
+    SET("dc_bytes",       bytes[TABLE_DC]);
+    SET("ac_bytes",       bytes[TABLE_AC]);
+    if (s->alpha_tables)
+        SET("alpha_bytes", bytes[TABLE_ALPHA_DC] + bytes[TABLE_ALPHA_AC]);
+    SET("slice_bytes_min", slice_min);
+    SET("slice_bytes_avg", total / s->nb_slices);
+    SET("slice_bytes_max", slice_max);
+#undef SET
+
+    return 0;
+}
+
+static int decode_frame(AVCodecContext *avctx,
+                        AVFrame *frame, int *got_frame,
+                        AVPacket *avpkt)
+{
+    VMIXContext *s = avctx->priv_data;
+    unsigned offset, q;
+    int ret, quality_level;
+
+    if (avpkt->size <= 7)
+        return AVERROR_INVALIDDATA;
+
+    ret = ff_vmix_parse_header(avpkt->data, avpkt->size, &s->lshift, &quality_level);
+    if (ret < 0 || s->lshift > 31)
+        return AVERROR_INVALIDDATA;
+    offset = ret;
+
+    q = ff_vmix_quality[FFMIN(quality_level, VMIX_QUALITY_MAX)];
+    for (int n = 0; n < 64; n++)
+        s->factors[s->idsp.idct_permutation[n]] = ff_vmix_quant[n] * q;
+
+    s->nb_slices = (s->height + 15) / 16;
+    av_fast_mallocz(&s->slices, &s->slices_size, s->nb_slices * sizeof(*s->slices));
+    if (!s->slices)
+        return AVERROR(ENOMEM);
+
+    for (int t = TABLE_DC; t <= TABLE_AC; t++) {
+        ret = parse_slice_table(s, avpkt, &offset, t);
+        if (ret < 0)
+            return ret;
+    }
+
+    /* Keyed sources append DC and AC tables for an alpha plane coded
+     * like luma, which have to end the frame. */
+    s->alpha_tables = s->alpha && offset < avpkt->size;
+    if (s->alpha_tables) {
+        for (int t = TABLE_ALPHA_DC; t <= TABLE_ALPHA_AC; t++) {
+            ret = parse_slice_table(s, avpkt, &offset, t);
+            if (ret < 0)
+                return ret;
+        }
+        if (offset != avpkt->size)
             return AVERROR_INVALIDDATA;
+    }
 
-        s->slices[n].ac_size = slice_size;
-        s->slices[n].ac_ptr = avpkt->data + offset + 4;
-        offset += slice_size + 4;
+    if (s->packed) {
+        s->scratch_linesize = FFALIGN(avctx->coded_width, 32) << s->pixel_shift;
+        av_fast_malloc(&s->scratch, &s->scratch_size,
+                       FFMAX(avctx->thread_count, 1) * s->scratch_linesize * 32);
+        if (!s->scratch)
+            return AVERROR(ENOMEM);
     }
 
     ret = ff_thread_get_buffer(avctx, frame, 0);
     if (ret < 0)
         return ret;
 
+    if (avctx->export_side_data & AV_CODEC_EXPORT_DATA_VIDEO_ENC_PARAMS) {
+        ret = export_enc_params(avctx, frame, q);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (s->export_stats) {
+        ret = export_stats(avctx, frame, quality_level, q);
+        if (ret < 0)
+            return ret;
+    }
+
     avctx->execute2(avctx, decode_slices, frame, NULL, s->nb_slices);
+    for (int n = 0; n < s->nb_slices; n++)
+        if (s->slices[n].ret < 0)
+            return s->slices[n].ret;
 
     *got_frame = 1;
 
@@ -298,18 +738,39 @@ static av_cold int decode_end(AVCodecContext *avctx)
 {
     VMIXContext *s = avctx->priv_data;
     av_freep(&s->slices);
+    av_freep(&s->scratch);
     return 0;
 }
 
+#define OFFSET(x) offsetof(VMIXContext, x)
+#define VD AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_DECODING_PARAM
+static const AVOption options[] = {
+    { "export_stats", "Export the quality and slice sizes of every frame as metadata",
+        OFFSET(export_stats), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, VD },
+    { "packed", "Output UYVY422 or P216 instead of planar formats for streams without alpha",
+        OFFSET(output_packed), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, VD },
+    { NULL },
+};
+
+static const AVClass vmix_decoder_class = {
+    .class_name = "vmix decoder",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+    .category   = AV_CLASS_CATEGORY_DECODER,
+};
+
 const FFCodec ff_vmix_decoder = {
     .p.name           = "vmix",
     CODEC_LONG_NAME("vMix Video"),
     .p.type           = AVMEDIA_TYPE_VIDEO,
     .p.id             = AV_CODEC_ID_VMIX,
     .priv_data_size   = sizeof(VMIXContext),
+    .p.priv_class     = &vmix_decoder_class,
     .init             = decode_init,
     .close            = decode_end,
     FF_CODEC_DECODE_CB(decode_frame),
-    .p.capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_FRAME_THREADS |
-                        AV_CODEC_CAP_SLICE_THREADS,
+    .p.capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DRAW_HORIZ_BAND |
+                        AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS,
+    .p.max_lowres     = 3,
 };
@@ -0,0 +1,321 @@
+/*
+ * vMix VMX encoder
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * vMix VMX encoder
+ *
+ * Every frame is coded as 16 line slices of 8x8 DCT blocks. For each
+ * slice the DC values of all planes are coded as differences in one
+ * table and the zigzag scanned AC levels in another, both as signed
+ * Exp-Golomb codes where a zero is followed by the run of further zeros.
+ * An alpha plane, if any, gets its own pair of tables after them.
+ */
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/mem_internal.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+
+#include "avcodec.h"
+#include "bytestream.h"
+#include "codec_internal.h"
+#include "encode.h"
+#include "fdctdsp.h"
+#include "mathops.h"
+#include "put_bits.h"
+#include "put_golomb.h"
+#include "vmix.h"
+
+enum SliceTable {
+    TABLE_DC,
+    TABLE_AC,
+    TABLE_ALPHA_DC,
+    TABLE_ALPHA_AC,
+    NB_TABLES,
+};
+
+typedef struct SliceContext {
+    uint8_t *buf[NB_TABLES];
+    unsigned size[NB_TABLES];
+} SliceContext;
+
+typedef struct VMIXEncContext {
+    const AVClass *class;
+    int quality;
+
+    int pixel_shift;
+    int alpha;
+    int nb_slices;
+    int nb_tables;
+    unsigned buf_size[NB_TABLES];
+
+    int factors[64];
+
+    SliceContext *slices;
+
+    FDCTDSPContext fdsp;
+} VMIXEncContext;
+
+static av_cold int encode_init(AVCodecContext *avctx)
+{
+    VMIXEncContext *s = avctx->priv_data;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(avctx->pix_fmt);
+    const int q = ff_vmix_quality[s->quality];
+    int blocks;
+
+    s->pixel_shift = desc->comp[0].depth > 8;
+    s->alpha       = !!(desc->flags & AV_PIX_FMT_FLAG_ALPHA);
+    s->nb_slices   = (avctx->height + 15) / 16;
+    s->nb_tables   = s->alpha ? NB_TABLES : TABLE_ALPHA_DC;
+
+    /* Neither the depth nor the presence of alpha is coded in the
+     * bitstream, containers have to signal them. */
+    avctx->bits_per_raw_sample   = desc->comp[0].depth;
+    avctx->bits_per_coded_sample = s->alpha ? 32 : 24;
+
+    for (int i = 0; i < 64; i++)
+        s->factors[i] = ff_vmix_quant[i] * q;
+
+    /* A DC difference takes at most 31 bits plus a run, an AC level at
+     * most 31 bits, for both bit depths. */
+    blocks = 2 * ((avctx->width + 7) / 8 + 2 * (((avctx->width >> 1) + 7) / 8));
+    s->buf_size[TABLE_DC] = blocks * 8 + 3 + AV_INPUT_BUFFER_PADDING_SIZE;
+    s->buf_size[TABLE_AC] = blocks * 64 * 4 + 3 + AV_INPUT_BUFFER_PADDING_SIZE;
+    blocks = 2 * ((avctx->width + 7) / 8);
+    s->buf_size[TABLE_ALPHA_DC] = blocks * 8 + 1 + AV_INPUT_BUFFER_PADDING_SIZE;
+    s->buf_size[TABLE_ALPHA_AC] = blocks * 64 * 4 + 1 + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    s->slices = av_calloc(s->nb_slices, sizeof(*s->slices));
+    if (!s->slices)
+        return AVERROR(ENOMEM);
+    for (int n = 0; n < s->nb_slices; n++) {
+        for (int t = 0; t < s->nb_tables; t++) {
+            s->slices[n].buf[t] = av_malloc(s->buf_size[t]);
+            if (!s->slices[n].buf[t])
+                return AVERROR(ENOMEM);
+        }
+    }
+
+    ff_fdctdsp_init(&s->fdsp, avctx);
+
+    return 0;
+}
+
+static inline void put_se_golomb_vmix(PutBitContext *pb, int v)
+{
+    set_ue_golomb_long(pb, v >= 0 ? 2U * v : -2U * v - 1);
+}
+
+/**
+ * Load an 8x8 block centred around zero, replicating the last column
+ * and row of the picture into blocks crossing its edges.
+ */
+static void get_block(int16_t *block, const uint8_t *src, ptrdiff_t linesize,
+                      int x, int y, int width, int height, int pixel_shift)
+{
+    const int mid = 128 << 2 * pixel_shift;
+
+    for (int j = 0; j < 8; j++) {
+        const uint8_t *row = src + FFMIN(y + j, height - 1) * linesize;
+
+        for (int i = 0; i < 8; i++) {
+            const int xx = FFMIN(x + i, width - 1);
+            const int v  = pixel_shift ? AV_RN16(row + 2 * xx) : row[xx];
+
+            block[8 * j + i] = v - mid;
+        }
+    }
+}
+
+static void encode_plane(AVCodecContext *avctx, const AVFrame *frame,
+                         int plane, int y, PutBitContext *dc_pb,
+                         PutBitContext *ac_pb)
+{
+    VMIXEncContext *s = avctx->priv_data;
+    LOCAL_ALIGNED_16(int16_t, block, [64]);
+    const int chroma = plane == 1 || plane == 2;
+    /* the decoder iterates over the same number of blocks */
+    const int width  = chroma ? avctx->width >> 1 : avctx->width;
+    const int pwidth = chroma ? AV_CEIL_RSHIFT(avctx->width, 1) : avctx->width;
+    const int dc_add = chroma ? 1024 << 2 * s->pixel_shift : 0;
+    /* the fdct output is scaled by 8 for 8-bit and by 4 for 10-bit */
+    const int shift  = 3 - s->pixel_shift;
+    const int ac_mul = 16 >> shift;
+    int dc_prev = 0, dc_run = -1, ac_run = -1;
+
+    for (int by = 0; by < 2; by++) {
+        for (int x = 0; x < width; x += 8) {
+            int dc;
+
+            get_block(block, frame->data[plane], frame->linesize[plane],
+                      x, y + 8 * by, pwidth, avctx->height, s->pixel_shift);
+            s->fdsp.fdct(block);
+
+            dc = ((block[0] + (1 << (shift - 1))) >> shift) + dc_add;
+            if (dc_run >= 0 && dc == dc_prev) {
+                dc_run++;
+            } else {
+                if (dc_run >= 0)
+                    set_ue_golomb_long(dc_pb, dc_run);
+                put_se_golomb_vmix(dc_pb, dc - dc_prev);
+                dc_run = dc == dc_prev ? 0 : -1;
+                dc_prev = dc;
+            }
+
+            for (int n = 0; n < 64; n++) {
+                int level = 0;
+
+                /* position 0 is coded, but carries no information */
+                if (n) {
+                    const int i = ff_zigzag_direct[n];
+                    const int f = s->factors[i];
+
+                    level = (FFABS(block[i]) * ac_mul + (f >> 1)) / f;
+                    if (block[i] < 0)
+                        level = -level;
+                }
+
+                if (ac_run >= 0 && !level) {
+                    ac_run++;
+                } else {
+                    if (ac_run >= 0)
+                        set_ue_golomb_long(ac_pb, ac_run);
+                    put_se_golomb_vmix(ac_pb, level);
+                    ac_run = level ? -1 : 0;
+                }
+            }
+        }
+    }
+
+    /* runs do not cross plane boundaries */
+    if (dc_run >= 0)
+        set_ue_golomb_long(dc_pb, dc_run);
+    if (ac_run >= 0)
+        set_ue_golomb_long(ac_pb, ac_run);
+    align_put_bits(dc_pb);
+    align_put_bits(ac_pb);
+}
+
+static int encode_slice(AVCodecContext *avctx, void *arg,
+                        int n, int thread_nb)
+{
+    VMIXEncContext *s = avctx->priv_data;
+    SliceContext *sl = &s->slices[n];
+    const AVFrame *frame = arg;
+
+    for (int t = TABLE_DC; t < s->nb_tables; t += 2) {
+        const int planes[2] = { t == TABLE_DC ? 0 : 3, t == TABLE_DC ? 3 : 4 };
+        PutBitContext dc_pb, ac_pb;
+
+        init_put_bits(&dc_pb, sl->buf[t],     s->buf_size[t]);
+        init_put_bits(&ac_pb, sl->buf[t + 1], s->buf_size[t + 1]);
+
+        for (int p = planes[0]; p < planes[1]; p++)
+            encode_plane(avctx, frame, p, n * 16, &dc_pb, &ac_pb);
+
+        flush_put_bits(&dc_pb);
+        flush_put_bits(&ac_pb);
+        sl->size[t]     = put_bytes_output(&dc_pb);
+        sl->size[t + 1] = put_bytes_output(&ac_pb);
+    }
+
+    return 0;
+}
+
+static int encode_frame(AVCodecContext *avctx, AVPacket *pkt,
+                        const AVFrame *frame, int *got_packet)
+{
+    VMIXEncContext *s = avctx->priv_data;
+    int64_t size = 3;
+    uint8_t *buf;
+    int ret;
+
+    avctx->execute2(avctx, encode_slice, (void *)frame, NULL, s->nb_slices);
+
+    for (int t = 0; t < s->nb_tables; t++)
+        for (int n = 0; n < s->nb_slices; n++)
+            size += 4 + s->slices[n].size[t];
+
+    ret = ff_get_encode_buffer(avctx, pkt, size, 0);
+    if (ret < 0)
+        return ret;
+
+    buf = pkt->data;
+    bytestream_put_byte(&buf, 1);
+    bytestream_put_byte(&buf, s->quality);
+    bytestream_put_byte(&buf, 0);
+    for (int t = 0; t < s->nb_tables; t++) {
+        for (int n = 0; n < s->nb_slices; n++) {
+            bytestream_put_le32(&buf, s->slices[n].size[t]);
+            bytestream_put_buffer(&buf, s->slices[n].buf[t], s->slices[n].size[t]);
+        }
+    }
+
+    *got_packet = 1;
+
+    return 0;
+}
+
+static av_cold int encode_close(AVCodecContext *avctx)
+{
+    VMIXEncContext *s = avctx->priv_data;
+
+    for (int n = 0; s->slices && n < s->nb_slices; n++)
+        for (int t = 0; t < NB_TABLES; t++)
+            av_freep(&s->slices[n].buf[t]);
+    av_freep(&s->slices);
+
+    return 0;
+}
+
+#define OFFSET(x) offsetof(VMIXEncContext, x)
+#define VE AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption options[] = {
+    { "quality", "Quality level, higher is better", OFFSET(quality), AV_OPT_TYPE_INT, { .i64 = 90 }, VMIX_QUALITY_MIN, VMIX_QUALITY_MAX, VE },
+    { NULL },
+};
+
+static const AVClass vmix_class = {
+    .class_name = "vmix",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+const FFCodec ff_vmix_encoder = {
+    .p.name           = "vmix",
+    CODEC_LONG_NAME("vMix Video"),
+    .p.type           = AVMEDIA_TYPE_VIDEO,
+    .p.id             = AV_CODEC_ID_VMIX,
+    .p.capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_FRAME_THREADS |
+                        AV_CODEC_CAP_SLICE_THREADS |
+                        AV_CODEC_CAP_ENCODER_REORDERED_OPAQUE,
+    .priv_data_size   = sizeof(VMIXEncContext),
+    .p.priv_class     = &vmix_class,
+    .init             = encode_init,
+    .close            = encode_close,
+    FF_CODEC_ENCODE_CB(encode_frame),
+    CODEC_PIXFMTS(AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV422P10,
+                  AV_PIX_FMT_YUVA422P, AV_PIX_FMT_YUVA422P10),
+    .color_ranges     = AVCOL_RANGE_MPEG,
+    .caps_internal    = FF_CODEC_CAP_INIT_CLEANUP,
+};
@@ -297,6 +297,17 @@ enum AVDevToAppMessageType {
      * data: double: new volume with range of 0.0 - 1.0.
      */
     AV_DEV_TO_APP_VOLUME_LEVEL_CHANGED = MKBETAG('C','V','O','L'),
+
+    /**
+     * Tally state change message.
+     *
+     * Device informs that the tally of an output has changed, e.g. that it
+     * was taken on or off program by a receiving vision mixer. It is sent
+     * from the thread calling av_write_frame() or av_write_uncoded_frame().
+     *
+     * data: int[2]: program and preview state, 0 for off, non-zero for on.
+     */
+    AV_DEV_TO_APP_TALLY_CHANGED = MKBETAG('T','A','L','Y'),
 };
 
 /**
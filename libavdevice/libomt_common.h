@@ -22,9 +22,44 @@
 #ifndef AVDEVICE_LIBOMT_COMMON_H
 #define AVDEVICE_LIBOMT_COMMON_H
 
+#include "libavutil/pixfmt.h"
+
 #include "libomt.h"
 
 #define OMT_TIME_BASE 10000000
 #define OMT_TIME_BASE_Q (AVRational){1, OMT_TIME_BASE}
 
+/* libomt accepts at most 32 channels of FPA1 audio per frame */
+#define OMT_MAX_AUDIO_CHANNELS 32
+
+/*
+ * OMT only signals BT.601 and BT.709 YUV matrices. Undefined tells the
+ * receiver to pick one from the frame size, BT.601 below 720 lines and
+ * BT.709 above, which is also the right answer for unspecified input.
+ */
+static inline enum OMTColorSpace omt_color_space_from_av(enum AVColorSpace csp)
+{
+    switch (csp) {
+    case AVCOL_SPC_BT709:
+        return OMTColorSpace_BT709;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+        return OMTColorSpace_BT601;
+    default:
+        return OMTColorSpace_Undefined;
+    }
+}
+
+static inline enum AVColorSpace omt_color_space_to_av(enum OMTColorSpace cs, int height)
+{
+    switch (cs) {
+    case OMTColorSpace_BT709:
+        return AVCOL_SPC_BT709;
+    case OMTColorSpace_BT601:
+        return AVCOL_SPC_SMPTE170M;
+    default:
+        return height < 720 ? AVCOL_SPC_SMPTE170M : AVCOL_SPC_BT709;
+    }
+}
+
 #endif
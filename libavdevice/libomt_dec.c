@@ -19,16 +19,20 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "libavcodec/vmix.h"
 #include "libavformat/avformat.h"
 #include "libavutil/opt.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/log.h"    
 #include "libomt_common.h"
+#include "libavutil/avstring.h"
 #include "libavutil/channel_layout.h"
 #include "libavutil/internal.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
 #include "libavutil/time.h"
+#include "libavutil/timecode.h"
 #include "libavformat/demux.h"
 #include "libavformat/internal.h"
 #include "avdevice.h"
@@ -43,41 +47,134 @@ struct OMTContext {
     int find_sources;
     int tenbit;
     int nativevmx;
+    int suggested_quality;
     omt_receive_t *recv;    
     AVStream *video_st, *audio_st;
+    int timecode_warned;
+    int vmx_quality;        // quality byte of the last VMX frame, -1 before the first
 };
 
-static void convert_p216_to_yuv422p10le(uint16_t* src_p216,  int linesizeP216, uint16_t* tgt_y,  uint16_t* tgt_cb,  uint16_t* tgt_cr,  int width, int height)
+/*
+ * P216 is a plane of 16-bit luma followed by a plane of interleaved 16-bit
+ * CbCr, both with the given stride. The output is packed yuv422p10le.
+ */
+static void convert_p216_to_yuv422p10le(const uint8_t *src, int stride, uint8_t *dst,
+                                        int width, int height)
 {
-    int y;
-    int sourceYOffset,sourceUVOffset, targetYOffset, targetUVOffset;
-    uint16_t *ylocal = tgt_y;
-    uint16_t *ulocal = tgt_cb;
-    uint16_t *vlocal = tgt_cr;
-       
-    sourceUVOffset =  height * linesizeP216;
-    sourceYOffset = 0;
-    targetYOffset = 0;
-    targetUVOffset = 0; 
-    
-    /* LUMA FIRST */
-    for (y=0;y<height*width;y+=2) {
-        ylocal[targetYOffset++] = (src_p216[sourceYOffset++]) >> 6;
-        ylocal[targetYOffset++] = (src_p216[sourceYOffset++]) >> 6;
+    const uint8_t *src_uv = src + (size_t)stride * height;
+    uint16_t *dst_y  = (uint16_t *)dst;
+    uint16_t *dst_cb = dst_y  + (size_t)width * height;
+    uint16_t *dst_cr = dst_cb + (size_t)(width / 2) * height;
+
+    for (int y = 0; y < height; y++) {
+        const uint16_t *sy  = (const uint16_t *)(src    + (size_t)y * stride);
+        const uint16_t *suv = (const uint16_t *)(src_uv + (size_t)y * stride);
+
+        for (int x = 0; x < width; x++)
+            *dst_y++ = sy[x] >> 6;
+        for (int x = 0; x < width / 2; x++) {
+            *dst_cb++ = suv[2 * x]     >> 6;
+            *dst_cr++ = suv[2 * x + 1] >> 6;
+        }
     }
-    
-    /* CHROMA */
-    sourceUVOffset =  height * width;
-    targetUVOffset = 0;
-    for (y=0;y<height*width;y+=2) {
-        ulocal[targetUVOffset] = (src_p216[sourceUVOffset++]) >> 6;
-        vlocal[targetUVOffset++] = (src_p216[sourceUVOffset++]) >> 6;
+}
+
+
+
+/*
+ * Minimal lookup of attr="value" inside the first <element .../> of the
+ * per-frame XML metadata. Returns 1 and the unescaped-as-is value in buf
+ * if found.
+ */
+static int omt_xml_attr(const char *xml, const char *element, const char *attr,
+                        char *buf, int size)
+{
+    char key[64];
+    const char *p, *end, *val;
+    int len;
+
+    snprintf(key, sizeof(key), "<%s ", element);
+    if (!xml || !(p = strstr(xml, key)) || !(end = strchr(p, '>')))
+        return 0;
+
+    snprintf(key, sizeof(key), " %s=\"", attr);
+    len = strlen(key);
+    p   = strstr(p, key);
+    if (!p || p > end)
+        return 0;
+
+    val = p + len;
+    p   = strchr(val, '"');
+    if (!p || p > end)
+        return 0;
+
+    av_strlcpy(buf, val, FFMIN(size, p - val + 1));
+    return 1;
+}
+
+/*
+ * Export <timecode value="hh:mm:ss:ff"/> from the per-frame metadata as
+ * S12M side data, and the first one as the timecode of the video stream.
+ */
+static int omt_set_timecode(AVFormatContext *avctx, OMTMediaFrame *v, AVPacket *pkt)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    const char *xml = v->FrameMetadataLength > 0 ? v->FrameMetadata : NULL;
+    AVRational rate = av_make_q(v->FrameRateN, v->FrameRateD);
+    char buf[AV_TIMECODE_STR_SIZE];
+    AVTimecode tc;
+
+    if (!omt_xml_attr(xml, "timecode", "value", buf, sizeof(buf)))
+        return 0;
+
+    if (av_timecode_init_from_string(&tc, rate, buf, NULL) < 0) {
+        if (!ctx->timecode_warned)
+            av_log(avctx, AV_LOG_WARNING, "Invalid timecode %s at %d/%d fps\n",
+                   buf, rate.num, rate.den);
+        ctx->timecode_warned = 1;
+        return 0;
     }
-    
-    return;
+
+    /* S12M cannot represent more than 60 frames per second */
+    if (av_cmp_q(rate, av_make_q(60, 1)) <= 0) {
+        uint32_t *sd = (uint32_t *)av_packet_new_side_data(pkt, AV_PKT_DATA_S12M_TIMECODE,
+                                                           4 * sizeof(uint32_t));
+        if (!sd)
+            return AVERROR(ENOMEM);
+        sd[0] = 1;
+        sd[1] = av_timecode_get_smpte_from_framenum(&tc, 0);
+    }
+
+    if (!av_dict_get(ctx->video_st->metadata, "timecode", NULL, 0)) {
+        av_timecode_make_string(&tc, buf, 0);
+        av_dict_set(&ctx->video_st->metadata, "timecode", buf, 0);
+        ctx->video_st->event_flags |= AVSTREAM_EVENT_FLAG_METADATA_UPDATED;
+    }
+
+    return 0;
 }
 
+/*
+ * Export the quality the sender codes its VMX frames with, which it may
+ * change at any time, as the vmx_quality metadata of the video stream.
+ */
+static int omt_set_vmx_quality(AVFormatContext *avctx, const AVPacket *pkt)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    int lshift, quality, ret;
 
+    if (ff_vmix_parse_header(pkt->data, pkt->size, &lshift, &quality) < 0 ||
+        quality == ctx->vmx_quality)
+        return 0;
+
+    ret = av_dict_set_int(&ctx->video_st->metadata, "vmx_quality", quality, 0);
+    if (ret < 0)
+        return ret;
+    ctx->video_st->event_flags |= AVSTREAM_EVENT_FLAG_METADATA_UPDATED;
+    ctx->vmx_quality = quality;
+
+    return 0;
+}
 
 static int omt_set_video_packet(AVFormatContext *avctx, OMTMediaFrame *v, AVPacket *pkt)
 {
@@ -89,6 +186,10 @@ static int omt_set_video_packet(AVFormatContext *avctx, OMTMediaFrame *v, AVPack
 
     if (ctx->nativevmx && v->Codec == OMTCodec_VMX1)
         ret = av_new_packet(pkt, v->CompressedLength);
+    else if (v->Codec == OMTCodec_UYVY || v->Codec == OMTCodec_BGRA)
+        ret = av_new_packet(pkt, v->Height * v->Width * (v->Codec == OMTCodec_BGRA ? 4 : 2));
+    else if (v->Codec == OMTCodec_P216 || v->Codec == OMTCodec_PA16)
+        ret = av_new_packet(pkt, av_image_get_buffer_size(AV_PIX_FMT_YUV422P10LE, v->Width, v->Height, 1));
     else
         ret = av_new_packet(pkt, v->Height * v->Stride);
     
@@ -112,19 +213,24 @@ static int omt_set_video_packet(AVFormatContext *avctx, OMTMediaFrame *v, AVPack
             av_log(avctx, AV_LOG_DEBUG, "Got a native VMX Packet\n");
             av_log(avctx, AV_LOG_DEBUG, "copy %d bytes of VMX into AVPacket\n",v->CompressedLength);
             memcpy(pkt->data, v->CompressedData, v->CompressedLength);
+            ret = omt_set_vmx_quality(avctx, pkt);
+            if (ret < 0)
+                return ret;
         break;
         
-        case OMTCodec_UYVY:case OMTCodec_UYVA:case OMTCodec_BGRA:
+        case OMTCodec_UYVY:case OMTCodec_BGRA:
+            /* drop the padding at the end of each row */
+            av_image_copy_plane(pkt->data, pkt->size / v->Height, v->Data, v->Stride,
+                                pkt->size / v->Height, v->Height);
+        break;
+
+        case OMTCodec_UYVA:
              memcpy(pkt->data, v->Data, pkt->size);
         break;
         
         case OMTCodec_P216:case OMTCodec_PA16:
-        {
-            int uOff =  v->Stride * v->Height; 
-            int yOff = uOff+(v->Stride * v->Height >> 1) ; //2 bytes of every other pixel
-            convert_p216_to_yuv422p10le((uint16_t*)v->Data, v->Stride, (uint16_t*)pkt->data, (uint16_t*)((uint8_t*)pkt->data+uOff),  (uint16_t*)((uint8_t*)pkt->data+yOff), v->Width, v->Height);
+            convert_p216_to_yuv422p10le(v->Data, v->Stride, pkt->data, v->Width, v->Height);
             av_log(avctx, AV_LOG_DEBUG, "convert_p216_to_yuv422p10le\n");
-        }
         break;
         
         default:
@@ -132,7 +238,8 @@ static int omt_set_video_packet(AVFormatContext *avctx, OMTMediaFrame *v, AVPack
          break;
     }
     av_log(avctx, AV_LOG_DEBUG, "omt_set_video_packet memcpy %d bytes\n",pkt->size);
-    return 0;
+
+    return omt_set_timecode(avctx, v, pkt);
 }
 
 
@@ -225,7 +332,8 @@ static int omt_read_header(AVFormatContext *avctx)
         omt_find_sources(avctx, avctx->url);
         return  AVERROR(EIO);
     }
-    
+    ctx->vmx_quality = -1;
+
     if (ctx->nativevmx) {
         ctx->recv = omt_receive_create(avctx->url, (OMTFrameType)(OMTFrameType_Video | OMTFrameType_Audio | OMTFrameType_Metadata), (OMTPreferredVideoFormat)OMTPreferredVideoFormat_UYVYorUYVAorP216orPA16, (OMTReceiveFlags)OMTReceiveFlags_CompressedOnly);
     }  
@@ -244,12 +352,58 @@ static int omt_read_header(AVFormatContext *avctx)
     /* Set tally */
     omt_receive_settally(ctx->recv, (OMTTally *)&tally_state);
 
+    if (ctx->suggested_quality != OMTQuality_Default)
+        omt_receive_setsuggestedquality(ctx->recv, (OMTQuality)ctx->suggested_quality);
+
     avctx->ctx_flags |= AVFMTCTX_NOHEADER;
 
     return 0; 
 }
 
 
+static void omt_set_color_properties(AVFormatContext *avctx, AVCodecParameters *par,
+                                     const OMTMediaFrame *v)
+{
+    const char *xml = v->FrameMetadataLength > 0 ? v->FrameMetadata : NULL;
+    char buf[32];
+    int ret;
+
+    if (v->Codec == OMTCodec_BGRA) {
+        par->color_space = AVCOL_SPC_RGB;
+        par->color_range = AVCOL_RANGE_JPEG;
+    } else {
+        par->color_space = omt_color_space_to_av(v->ColorSpace, v->Height);
+        par->color_range = AVCOL_RANGE_MPEG;
+        if (par->color_space == AVCOL_SPC_BT709) {
+            par->color_primaries = AVCOL_PRI_BT709;
+            par->color_trc       = AVCOL_TRC_BT709;
+        } else {
+            par->color_primaries = v->Height == 576 ? AVCOL_PRI_BT470BG : AVCOL_PRI_SMPTE170M;
+            par->color_trc       = AVCOL_TRC_SMPTE170M;
+        }
+    }
+
+    /* Properties OMT cannot signal itself, as sent by our muxer with frame_metadata=hdr */
+    if (omt_xml_attr(xml, "colour", "primaries", buf, sizeof(buf)) &&
+        (ret = av_color_primaries_from_name(buf)) >= 0)
+        par->color_primaries = ret;
+    if (omt_xml_attr(xml, "colour", "transfer", buf, sizeof(buf)) &&
+        (ret = av_color_transfer_from_name(buf)) >= 0)
+        par->color_trc = ret;
+    if (omt_xml_attr(xml, "colour", "matrix", buf, sizeof(buf)) &&
+        (ret = av_color_space_from_name(buf)) >= 0)
+        par->color_space = ret;
+    if (omt_xml_attr(xml, "colour", "range", buf, sizeof(buf)) &&
+        (ret = av_color_range_from_name(buf)) >= 0)
+        par->color_range = ret;
+
+    av_log(avctx, AV_LOG_VERBOSE, "Video colour: %s/%s/%s, %s range\n",
+           av_color_space_name(par->color_space),
+           av_color_primaries_name(par->color_primaries),
+           av_color_transfer_name(par->color_trc),
+           av_color_range_name(par->color_range));
+}
+
 static int omt_create_video_stream(AVFormatContext *avctx, OMTMediaFrame *v)
 {
 
@@ -267,6 +421,7 @@ static int omt_create_video_stream(AVFormatContext *avctx, OMTMediaFrame *v)
 
     st->time_base                   = OMT_TIME_BASE_Q;
     st->r_frame_rate                = av_make_q(v->FrameRateN, v->FrameRateD);
+    st->avg_frame_rate              = st->r_frame_rate;
 
     tmp = av_mul_q(av_d2q(v->AspectRatio, INT_MAX), (AVRational){v->Height, v->Width});
     av_reduce(&st->sample_aspect_ratio.num, &st->sample_aspect_ratio.den, tmp.num, tmp.den, 1000);
@@ -287,6 +442,7 @@ static int omt_create_video_stream(AVFormatContext *avctx, OMTMediaFrame *v)
     st->codecpar->codec_id          = AV_CODEC_ID_RAWVIDEO;
     st->codecpar->bit_rate          = av_rescale(v->Width * v->Height * 16, v->FrameRateN, v->FrameRateD);
     st->codecpar->field_order       = (v->Flags & OMTVideoFlags_Interlaced) ? AV_FIELD_TT : AV_FIELD_PROGRESSIVE;
+    omt_set_color_properties(avctx, st->codecpar, v);
 
     switch(v->Codec)
     {
@@ -294,6 +450,16 @@ static int omt_create_video_stream(AVFormatContext *avctx, OMTMediaFrame *v)
         case OMTCodec_VMX1: 
             st->codecpar->codec_id  = AV_CODEC_ID_VMIX;
             st->codecpar->codec_tag  = MKTAG('V', 'M', 'X', '1');
+            /* the VMX bitstream does not signal its depth */
+            st->codecpar->bits_per_raw_sample = (v->Flags & OMTVideoFlags_HighBitDepth) ? 10 : 8;
+            st->codecpar->bits_per_coded_sample = (v->Flags & OMTVideoFlags_Alpha) ? 32 : 24;
+            /* Everything else the decoder would be probed for is known, so
+             * the packets can be stream copied without decoding any. */
+            if (v->Flags & OMTVideoFlags_HighBitDepth)
+                st->codecpar->format = (v->Flags & OMTVideoFlags_Alpha) ? AV_PIX_FMT_YUVA422P10 : AV_PIX_FMT_YUV422P10;
+            else
+                st->codecpar->format = (v->Flags & OMTVideoFlags_Alpha) ? AV_PIX_FMT_YUVA422P : AV_PIX_FMT_YUV422P;
+            st->codecpar->bit_rate = av_rescale(v->CompressedLength * 8LL, v->FrameRateN, v->FrameRateD);
         break;
         
         case OMTCodec_UYVY:case OMTCodec_UYVA:
@@ -377,16 +543,6 @@ static int omt_read_packet(AVFormatContext *avctx, AVPacket *pkt)
                 ret = omt_create_video_stream(avctx, theOMTFrame);
             if (!ret)
                 ret = omt_set_video_packet(avctx, theOMTFrame, pkt);
-                
-            if (ctx->nativevmx)  {
-                av_log(avctx, AV_LOG_DEBUG, "Compressed Data RECVD %d bytes\n", theOMTFrame->CompressedLength);
-                for (int i=0;i<64;i++)
-                {
-                    av_log(avctx, AV_LOG_DEBUG, "%02x ",((uint8_t*)(theOMTFrame->CompressedData))[i]);
-                }
-                av_log(avctx, AV_LOG_DEBUG, "\n");
-            }
-
         break;
         
         case OMTFrameType_Audio:
@@ -431,6 +587,11 @@ static const AVOption options[] = {
     { "tenbit", "Decode into 10-bit if possible"  , OFFSET(tenbit), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, DEC },
     { "reference_level", "The audio reference level as floating point full scale deflection", OFFSET(reference_level), AV_OPT_TYPE_FLOAT, { .dbl = 1.0 }, 0.0, 20.0, DEC },
     { "nativevmx", "Ingest native VMX"  , OFFSET(nativevmx), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, DEC },
+    { "suggested_quality", "Video quality suggested to the sender", OFFSET(suggested_quality), AV_OPT_TYPE_INT, { .i64 = OMTQuality_Default }, 0, 100, DEC, .unit = "quality" },
+        { "default", "Defer to the other receivers", 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Default }, 0, 0, DEC, .unit = "quality" },
+        { "low",     NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Low },    0, 0, DEC, .unit = "quality" },
+        { "medium",  NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Medium }, 0, 0, DEC, .unit = "quality" },
+        { "high",    NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_High },   0, 0, DEC, .unit = "quality" },
     { NULL },
 };
 
@@ -20,74 +20,296 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
 
 #include "libavformat/avformat.h"
 #include "libavformat/internal.h"
+#include "libavutil/audio_fifo.h"
+#include "libavutil/avassert.h"
+#include "libavutil/avstring.h"
+#include "libavutil/base64.h"
+#include "libavutil/bprint.h"
+#include "libavutil/mastering_display_metadata.h"
 #include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/slicethread.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/log.h"   
 #include "libavutil/frame.h"
 #include "libavutil/mem.h"
 #include "libavutil/channel_layout.h"
+#include "libavutil/cpu.h"
 #include "libavutil/internal.h"
 #include "libavutil/frame.h"
 #include "libavutil/internal.h"
 #include "libavutil/time.h"
+#include "libavutil/timecode.h"
+#include "libavutil/thread.h"
+#include "libavutil/threadmessage.h"
 #include "libavformat/internal.h"
 #include "libavformat/mux.h"
 #include "avdevice.h"
 #include "libavdevice/version.h"
+#include "timefilter.h"
 
 #include "libomt_common.h"
 
+/* Side data serialised into the per-frame metadata */
+#define OMT_METADATA_TIMECODE   (1 << 0)
+#define OMT_METADATA_HDR        (1 << 1)
+#define OMT_METADATA_CAPTIONS   (1 << 2)
+#define OMT_METADATA_SEI        (1 << 3)
+
+/* How often the tally of each sender is polled, in microseconds */
+#define OMT_TALLY_POLL_INTERVAL 100000
+
+/* How long the program tally has to hold before program_quality is switched */
+#define OMT_QUALITY_SWITCH_HOLD 2000000
+
+/* DLL bandwidth used to follow the source frame rate when pacing, in Hz */
+#define OMT_PACING_BANDWIDTH    0.5
+
+/* libomt limit for per-frame metadata, including the terminating null */
+#define OMT_MAX_FRAME_METADATA  65536
+
+/* Rows per job when converting video with low_latency */
+#define OMT_SLICE_HEIGHT        16
+
+enum OMTQueueOverflow {
+    OMT_OVERFLOW_BLOCK,
+    OMT_OVERFLOW_DROP_NEW,
+    OMT_OVERFLOW_DROP_OLD,
+};
+
+typedef struct OMTQueueEntry {
+    AVPacket *pkt;
+    int64_t enqueue_time;
+    int is_frame;           ///< pkt data is an AVFrame from omt_write_uncoded_frame()
+} OMTQueueEntry;
+
+/* References keeping the data of a frame handed to libomt alive. */
+typedef struct OMTInflight {
+    AVFrame *frame;
+    AVPacket *pkt;
+    AVBufferRef *buf;
+    char *metadata;
+} OMTInflight;
+
+/*
+ * libomt does not report when it is done with the data of a frame, so the
+ * depth cannot be derived from send completion: it is an upper bound, set
+ * by inflight_frames, on how many further frames libomt may be sent before
+ * it stops reading an earlier one. The ring holds the references of the
+ * last inflight_frames frames; pushing a new frame releases the oldest.
+ */
+typedef struct OMTInflightRing {
+    OMTInflight *entries;
+    int size;
+    int next;                           // slot of the oldest frame, reused by the next push
+} OMTInflightRing;
+
+/* One OMT source on the network, carrying at most one video and one audio stream. */
+typedef struct OMTSender {
+    AVFormatContext *avctx;
+    char *name;
+    AVStream *video_st;
+    AVStream *audio_st;
+    AVStream *data_st;
+    OMTMediaFrame video; 
+    OMTMediaFrame audio;
+    enum AVSampleFormat audio_fmt;      // sample format of audio packets
+    AVBufferPool *audio_pool;           // planar float conversion buffers
+    size_t audio_pool_size;
+    OMTInflightRing audio_inflight;
+    AVAudioFifo *audio_fifo;            // planar float samples waiting to be re-blocked
+    int64_t audio_fifo_pts;             // timestamp of the first sample in audio_fifo, in samples
+    int64_t audio_blocks;               // number of re-blocked audio frames sent
+    omt_send_t * omt_send;
+    AVBufferPool *video_pool;           // P216 conversion buffers
+    size_t video_pool_size;
+    OMTInflightRing video_inflight;
+    char *last_metadata;                // last metadata frame sent from the data stream
+
+    /* send thread */
+    AVThreadMessageQueue *queue;
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;               // protects wake_count and replacing omt_send
+    pthread_cond_t wake_cond;           // signals new queue entries to the thread while
+    int64_t wake_count;                 // it waits with a timeout to repeat frames
+    int wake_init;
+
+    /* tally */
+    OMTTally tally;
+    int64_t last_tally_poll;
+    int64_t tally_program_time;         // when the program tally last changed
+    int quality_program;                // the quality in use is program_quality
+
+    /* frame repeat on underrun */
+    AVBufferRef *silence;
+    int64_t audio_next_ts;              // OMT timestamp following the last audio frame
+    int64_t last_video_time;            // when the last video frame was sent
+    int64_t repeat_slot;                // pacing slot of the next repeat
+    int repeating;
+    int64_t nb_repeated;
+
+    /* connection tracking and statistics */
+    int connected;
+    int64_t nb_idle_skipped;
+    int64_t last_stats_time;
+
+    /* queue counters */
+    int64_t nb_queued;
+    int64_t nb_sent;
+    int64_t nb_dropped_overflow;
+    int64_t nb_dropped_late;
+    int max_queue_depth;
+
+    /* pacing */
+    TimeFilter *pace_filter;
+    int64_t arrival_time;               // when the packet being written reached the muxer
+    int64_t pace_base_pts;              // pts of the frame the schedule is based on, in AV_TIME_BASE
+    int64_t pace_base_slot;             // frame grid slot of that frame
+    int64_t last_slot;                  // frame grid slot of the last video frame sent
+    int64_t nb_paced;
+    int64_t nb_dropped_pacing;
+
+    /* low latency conversion */
+    AVSliceThread *slicethread;
+    const AVFrame *convert_src;
+    uint8_t *convert_dst;
+
+    /* capture to send latency, in microseconds */
+    int64_t latency_min;
+    int64_t latency_max;
+    int64_t latency_sum;
+    int64_t latency_count;
+    int latency_warned;
+
+    /* start timecode for frames without S12M side data */
+    AVTimecode timecode;
+    int has_timecode;
+    int64_t timecode_pts;               // pts the start timecode applies to
+} OMTSender;
 
 struct OMTContext {
     const AVClass *class;  // MUST be first field for AVOptions!
- //   void *ctx;
     float reference_level;
     int clock_output;
-    //int tenbit;
-    OMTMediaFrame video; 
-    OMTMediaFrame audio;
-    float * floataudio;
-    omt_send_t * omt_send;
-    uint8_t * uyvyflip[2];
-    int whichFlipBuff;
-    struct AVFrame *last_avframe;
+    char *name_template;
+    int audio_frame_size;
+    int skip_idle;
+    int64_t stats_interval;
+    int frame_metadata;
+    char *connection_metadata;
+    int quality;
+    char *product_name;
+    char *manufacturer;
+    char *product_version;
+    char *redirect;
+    char *redirect_applied;
+
+    OMTSender *senders;
+    int nb_senders;
+    int *stream_sender;     // index into senders for each stream
+
+    /* send thread */
+    int send_thread;
+    int queue_size;
+    int queue_overflow;
+    int64_t late_threshold;
+
+    /* pacing */
+    int pacing;
+    int64_t pacing_reference;
+    int64_t pacing_latency;
+    int64_t repeat_timeout;
+    int program_quality;
+    int inflight_frames;
+    int low_latency;
+    int convert_threads;
+    int report_latency;
 };
 
+static int omt_inflight_alloc(OMTInflightRing *ring, int size)
+{
+    ring->entries = av_calloc(size, sizeof(*ring->entries));
+    if (!ring->entries)
+        return AVERROR(ENOMEM);
+    ring->size = size;
+    ring->next = 0;
+    return 0;
+}
 
+static void omt_inflight_unref(OMTInflight *entry)
+{
+    av_frame_free(&entry->frame);
+    av_packet_free(&entry->pkt);
+    av_buffer_unref(&entry->buf);
+    av_freep(&entry->metadata);
+}
 
-static int omt_write_trailer(AVFormatContext *avctx)
+/* Take over the references in entry for a frame that was just sent. */
+static void omt_inflight_push(OMTInflightRing *ring, OMTInflight *entry)
 {
-     av_log(avctx, AV_LOG_DEBUG, "omt_write_trailer.\n");
+    OMTInflight *slot = &ring->entries[ring->next];
 
-    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
-    
-    if (ctx->omt_send) {
-        omt_send_destroy(ctx->omt_send);
-        if(ctx->last_avframe)
-            av_frame_free(&ctx->last_avframe);
-    }
-    
-    if (ctx->floataudio) {
-        av_free(ctx->floataudio);
-        ctx->floataudio = 0;
+    omt_inflight_unref(slot);
+    *slot = *entry;
+    memset(entry, 0, sizeof(*entry));
+    ring->next = (ring->next + 1) % ring->size;
+}
+
+static void omt_inflight_free(OMTInflightRing *ring)
+{
+    for (int i = 0; i < ring->size; i++)
+        omt_inflight_unref(&ring->entries[i]);
+    av_freep(&ring->entries);
+    ring->size = 0;
+}
+
+static AVBufferRef *omt_pool_get(AVBufferPool **pool, size_t *pool_size, size_t size)
+{
+    if (size > *pool_size) {
+        av_buffer_pool_uninit(pool);
+        *pool = av_buffer_pool_init(size, NULL);
+        if (!*pool)
+            return NULL;
+        *pool_size = size;
     }
- 
-    if (ctx->uyvyflip[0]) {
-        av_free(ctx->uyvyflip[0]);
-        ctx->uyvyflip[0] = 0;
+    return av_buffer_pool_get(*pool);
+}
+
+static void omt_stop_send_thread(OMTSender *sender)
+{
+    struct OMTContext *ctx = (struct OMTContext *)sender->avctx->priv_data;
+
+    if (sender->thread_started) {
+        av_thread_message_queue_set_err_recv(sender->queue, AVERROR_EOF);
+        pthread_mutex_lock(&sender->lock);
+        sender->wake_count++;
+        pthread_cond_signal(&sender->wake_cond);
+        pthread_mutex_unlock(&sender->lock);
+        pthread_join(sender->thread, NULL);
+        sender->thread_started = 0;
+
+        av_log(sender->avctx, AV_LOG_VERBOSE, "%s: send queue: %"PRId64" queued, %"PRId64" sent, "
+               "%"PRId64" dropped on overflow, %"PRId64" dropped late, max depth %d/%d\n",
+               sender->name, sender->nb_queued, sender->nb_sent, sender->nb_dropped_overflow,
+               sender->nb_dropped_late, sender->max_queue_depth, ctx->queue_size);
     }
-    if (ctx->uyvyflip[1]) {
-        av_free(ctx->uyvyflip[1]);
-        ctx->uyvyflip[1] = 0;
+    if (sender->wake_init) {
+        pthread_mutex_destroy(&sender->lock);
+        pthread_cond_destroy(&sender->wake_cond);
+        sender->wake_init = 0;
     }
- 
-    return 0;
+    av_thread_message_queue_free(&sender->queue);
 }
 
 
+
 static int dumpOMTMediaFrameInfo(AVFormatContext *avctx,OMTMediaFrame * video)
 {
     av_log(avctx, AV_LOG_DEBUG, "dumpOMTMediaFrameInfo OMTMediaFrame = %llu\n",(unsigned long long)video);
@@ -132,46 +354,518 @@ static int dumpOMTMediaFrameInfo(AVFormatContext *avctx,OMTMediaFrame * video)
 }
 
 
-static void convert_yuv422p10le_to_p216_PAD 
-(
-    uint16_t* src_y, int linesizeY, uint16_t* src_cb,  int linesizeU, uint16_t* src_cr, int linesizeV,
-    uint16_t* dst_p216,  int linesizeP216,
-    int width, int height)
-    {
-        uint16_t* dst_p216local = dst_p216;
-        uint16_t* localY = src_y;
-        uint16_t* localCB = src_cb;
-        uint16_t* localCR = src_cr;
-        uint16_t* dst_p216UVlocal =  (uint16_t*)((uint8_t*)dst_p216 + (height * linesizeY));  
-            
-        // is yuv422p10le 10bit packed ?  need to use 40 bit blocks (5 bytes for 4 pixels)
-        for (int y = 0; y < height >> 1 ; y++) {
-            for (int x = 0; x < width *2; x += 2) {
-                // Load 2 pixels worth of YUV422P10LE data
-                // Pack the data into the P216 format
-                 dst_p216local[x] = localY[x] << 6;
-                 dst_p216local[x + 1] = localY[x + 1]<< 6;
-                 dst_p216UVlocal[x] = localCB[x / 2] << 6 ;
-                 dst_p216UVlocal[x + 1] = localCR[x / 2] << 6;
-            }
+static void omt_bprint_base64(AVBPrint *bp, const uint8_t *data, int size)
+{
+    char *b64 = av_malloc(AV_BASE64_SIZE(size));
 
-            // Advance the pointers in bytes for each line
-            localY += linesizeY;
-            localCB += linesizeU;
-            localCR += linesizeV;
-            dst_p216local += linesizeP216;
-            dst_p216UVlocal += linesizeP216;
-        } 
-        return;   
+    if (b64 && av_base64_encode(b64, AV_BASE64_SIZE(size), data, size))
+        av_bprintf(bp, "%s", b64);
+    av_free(b64);
+}
+
+/*
+ * Print the timecode of a video frame, taken from its S12M side data or,
+ * failing that, counted in frames from the start timecode of the output.
+ */
+static void omt_bprint_timecode(AVBPrint *bp, OMTSender *ctx, AVStream *st,
+                                const uint8_t *sd, size_t size, int64_t pts)
+{
+    const uint32_t *tc = (const uint32_t *)sd;
+    char tcbuf[AV_TIMECODE_STR_SIZE];
+
+    if (tc && size >= 2 * sizeof(uint32_t) && tc[0] >= 1) {
+        av_timecode_make_smpte_tc_string2(tcbuf, st->avg_frame_rate, tc[1], 0, 0);
+    } else if (ctx->has_timecode && pts != AV_NOPTS_VALUE) {
+        if (ctx->timecode_pts == AV_NOPTS_VALUE)
+            ctx->timecode_pts = pts;
+        av_timecode_make_string(&ctx->timecode, tcbuf,
+                                av_rescale_q(pts - ctx->timecode_pts, st->time_base,
+                                             av_inv_q(st->avg_frame_rate)));
+    } else {
+        return;
     }
-    
+    av_bprintf(bp, "<timecode value=\"%s\"/>", tcbuf);
+}
 
-static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket *pkt)
+/*
+ * Serialise the side data selected by the frame_metadata option into the
+ * per-frame XML metadata, e.g.
+ * <ffmpeg><timecode value="10:00:00:00"/><a53_cc data="..."/></ffmpeg>
+ * frame is NULL for compressed video, of which only the timecode is sent.
+ * Returns NULL in *metadata if there is nothing to send.
+ */
+static int omt_build_frame_metadata(AVFormatContext *avctx, OMTSender *ctx, AVStream *st,
+                                    const AVFrame *frame, const AVPacket *pkt,
+                                    char **metadata)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    const AVFrameSideData *sd;
+    AVBPrint bp;
+
+    *metadata = NULL;
+    if (!octx->frame_metadata)
+        return 0;
+
+    av_bprint_init(&bp, 0, OMT_MAX_FRAME_METADATA);
+    av_bprintf(&bp, "<ffmpeg>");
+
+    if (octx->frame_metadata & OMT_METADATA_TIMECODE) {
+        if (frame) {
+            sd = av_frame_get_side_data(frame, AV_FRAME_DATA_S12M_TIMECODE);
+            omt_bprint_timecode(&bp, ctx, st, sd ? sd->data : NULL, sd ? sd->size : 0, pkt->pts);
+        } else {
+            size_t size;
+            const uint8_t *data = av_packet_get_side_data(pkt, AV_PKT_DATA_S12M_TIMECODE, &size);
+            omt_bprint_timecode(&bp, ctx, st, data, size, pkt->pts);
+        }
+    }
+
+    if (!frame)
+        goto finish;
+
+    if (octx->frame_metadata & OMT_METADATA_HDR) {
+        if (frame->color_primaries != AVCOL_PRI_UNSPECIFIED ||
+            frame->color_trc != AVCOL_TRC_UNSPECIFIED ||
+            frame->colorspace != AVCOL_SPC_UNSPECIFIED) {
+            av_bprintf(&bp, "<colour");
+            if (frame->color_primaries != AVCOL_PRI_UNSPECIFIED)
+                av_bprintf(&bp, " primaries=\"%s\"", av_color_primaries_name(frame->color_primaries));
+            if (frame->color_trc != AVCOL_TRC_UNSPECIFIED)
+                av_bprintf(&bp, " transfer=\"%s\"", av_color_transfer_name(frame->color_trc));
+            if (frame->colorspace != AVCOL_SPC_UNSPECIFIED)
+                av_bprintf(&bp, " matrix=\"%s\"", av_color_space_name(frame->colorspace));
+            if (frame->color_range != AVCOL_RANGE_UNSPECIFIED)
+                av_bprintf(&bp, " range=\"%s\"", av_color_range_name(frame->color_range));
+            av_bprintf(&bp, "/>");
+        }
+        if ((sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA))) {
+            const AVMasteringDisplayMetadata *m = (const AVMasteringDisplayMetadata *)sd->data;
+
+            av_bprintf(&bp, "<mastering_display");
+            if (m->has_primaries)
+                av_bprintf(&bp, " red_x=\"%d/%d\" red_y=\"%d/%d\" green_x=\"%d/%d\" green_y=\"%d/%d\""
+                           " blue_x=\"%d/%d\" blue_y=\"%d/%d\" white_point_x=\"%d/%d\" white_point_y=\"%d/%d\"",
+                           m->display_primaries[0][0].num, m->display_primaries[0][0].den,
+                           m->display_primaries[0][1].num, m->display_primaries[0][1].den,
+                           m->display_primaries[1][0].num, m->display_primaries[1][0].den,
+                           m->display_primaries[1][1].num, m->display_primaries[1][1].den,
+                           m->display_primaries[2][0].num, m->display_primaries[2][0].den,
+                           m->display_primaries[2][1].num, m->display_primaries[2][1].den,
+                           m->white_point[0].num, m->white_point[0].den,
+                           m->white_point[1].num, m->white_point[1].den);
+            if (m->has_luminance)
+                av_bprintf(&bp, " min_luminance=\"%d/%d\" max_luminance=\"%d/%d\"",
+                           m->min_luminance.num, m->min_luminance.den,
+                           m->max_luminance.num, m->max_luminance.den);
+            av_bprintf(&bp, "/>");
+        }
+        if ((sd = av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL))) {
+            const AVContentLightMetadata *c = (const AVContentLightMetadata *)sd->data;
+            av_bprintf(&bp, "<content_light max_content=\"%u\" max_average=\"%u\"/>",
+                       c->MaxCLL, c->MaxFALL);
+        }
+    }
+
+    if ((octx->frame_metadata & OMT_METADATA_CAPTIONS) &&
+        (sd = av_frame_get_side_data(frame, AV_FRAME_DATA_A53_CC))) {
+        av_bprintf(&bp, "<a53_cc data=\"");
+        omt_bprint_base64(&bp, sd->data, sd->size);
+        av_bprintf(&bp, "\"/>");
+    }
+
+    if (octx->frame_metadata & OMT_METADATA_SEI) {
+        for (int i = 0; i < frame->nb_side_data; i++) {
+            sd = frame->side_data[i];
+            if (sd->type != AV_FRAME_DATA_SEI_UNREGISTERED || sd->size < 16)
+                continue;
+            av_bprintf(&bp, "<sei_unregistered uuid=\"");
+            for (int j = 0; j < 16; j++)
+                av_bprintf(&bp, "%02x", sd->data[j]);
+            av_bprintf(&bp, "\" data=\"");
+            omt_bprint_base64(&bp, sd->data + 16, sd->size - 16);
+            av_bprintf(&bp, "\"/>");
+        }
+    }
+
+finish:
+    if (bp.len == strlen("<ffmpeg>")) {
+        av_bprint_finalize(&bp, NULL);
+        return 0;
+    }
+    av_bprintf(&bp, "</ffmpeg>");
+
+    if (!av_bprint_is_complete(&bp)) {
+        av_log(avctx, AV_LOG_WARNING, "Frame metadata exceeds %d bytes, not sent\n",
+               OMT_MAX_FRAME_METADATA);
+        av_bprint_finalize(&bp, NULL);
+        return 0;
+    }
+
+    return av_bprint_finalize(&bp, metadata);
+}
+
+/*
+ * Convert rows [y0, y1) of a yuv422p10le frame to P216: a plane of 16-bit
+ * luma followed by a plane of interleaved 16-bit CbCr, both with the
+ * given stride.
+ */
+static void omt_convert_p216_rows(const AVFrame *src, uint8_t *dst, int stride, int y0, int y1)
+{
+    uint8_t *dst_uv = dst + (size_t)stride * src->height;
+
+    for (int y = y0; y < y1; y++) {
+        const uint16_t *src_y  = (const uint16_t *)(src->data[0] + y * src->linesize[0]);
+        const uint16_t *src_cb = (const uint16_t *)(src->data[1] + y * src->linesize[1]);
+        const uint16_t *src_cr = (const uint16_t *)(src->data[2] + y * src->linesize[2]);
+        uint16_t *dy  = (uint16_t *)(dst    + (size_t)y * stride);
+        uint16_t *duv = (uint16_t *)(dst_uv + (size_t)y * stride);
+
+        for (int x = 0; x < src->width; x++)
+            dy[x] = src_y[x] << 6;
+        for (int x = 0; x < src->width / 2; x++) {
+            duv[2 * x]     = src_cb[x] << 6;
+            duv[2 * x + 1] = src_cr[x] << 6;
+        }
+    }
+}
+
+/* Slice thread job: convert one band of OMT_SLICE_HEIGHT rows. */
+static void omt_convert_p216_slice(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    OMTSender *ctx = priv;
+    int y0 = jobnr * OMT_SLICE_HEIGHT;
+
+    omt_convert_p216_rows(ctx->convert_src, ctx->convert_dst, ctx->video.Stride,
+                          y0, FFMIN(y0 + OMT_SLICE_HEIGHT, ctx->convert_src->height));
+}
+
+/* Video frames of this sender may go through omt_convert_p216(). */
+static int omt_sender_converts_video(const OMTSender *ctx)
+{
+    return ctx->video_st &&
+           ctx->video_st->codecpar->codec_id == AV_CODEC_ID_WRAPPED_AVFRAME;
+}
+
+static void omt_convert_p216(OMTSender *ctx, const AVFrame *src, uint8_t *dst)
+{
+    if (!ctx->slicethread) {
+        omt_convert_p216_rows(src, dst, ctx->video.Stride, 0, src->height);
+        return;
+    }
+    ctx->convert_src = src;
+    ctx->convert_dst = dst;
+    avpriv_slicethread_execute(ctx->slicethread,
+                               (src->height + OMT_SLICE_HEIGHT - 1) / OMT_SLICE_HEIGHT, 0);
+}
+
+/*
+ * Capture to send latency of a video frame, taken from its producer
+ * reference time if the packet has one, otherwise from its pts, which
+ * must then be wallclock based (-use_wallclock_as_timestamps 1 -copyts
+ * in ffmpeg).
+ */
+static void omt_update_latency(AVFormatContext *avctx, OMTSender *ctx, AVStream *st, AVPacket *pkt)
+{
+    const AVProducerReferenceTime *prft;
+    int64_t captured, latency;
+    size_t size;
+
+    prft = (const AVProducerReferenceTime *)av_packet_get_side_data(pkt, AV_PKT_DATA_PRFT, &size);
+    if (prft && size >= sizeof(*prft))
+        captured = prft->wallclock;
+    else if (pkt->pts != AV_NOPTS_VALUE)
+        captured = av_rescale_q(pkt->pts, st->time_base, AV_TIME_BASE_Q);
+    else
+        return;
+
+    latency = av_gettime() - captured;
+    if (latency < 0 || latency > 60 * AV_TIME_BASE) {
+        if (!ctx->latency_warned)
+            av_log(avctx, AV_LOG_WARNING, "%s: timestamps are not wallclock based, "
+                   "cannot measure latency\n", ctx->name);
+        ctx->latency_warned = 1;
+        return;
+    }
+
+    av_log(avctx, AV_LOG_DEBUG, "%s: frame pts %"PRId64" sent %"PRId64" us after capture\n",
+           ctx->name, pkt->pts, latency);
+    ctx->latency_min  = ctx->latency_count ? FFMIN(ctx->latency_min, latency) : latency;
+    ctx->latency_max  = FFMAX(ctx->latency_max, latency);
+    ctx->latency_sum += latency;
+    ctx->latency_count++;
+}
+
+static void omt_log_latency(AVFormatContext *avctx, OMTSender *ctx, int level)
+{
+    if (!ctx->latency_count)
+        return;
+    av_log(avctx, level, "%s: capture to send latency min %.1f ms, avg %.1f ms, max %.1f ms over %"PRId64" frames\n",
+           ctx->name, ctx->latency_min / 1000.0, ctx->latency_sum / 1000.0 / ctx->latency_count,
+           ctx->latency_max / 1000.0, ctx->latency_count);
+    ctx->latency_min = ctx->latency_max = ctx->latency_sum = ctx->latency_count = 0;
+}
+
+/*
+ * With a send thread, senders may be recreated by their thread while the
+ * muxer thread changes the redirect.
+ */
+static void omt_lock_sender(OMTSender *sender)
+{
+    if (sender->wake_init)
+        pthread_mutex_lock(&sender->lock);
+}
+
+static void omt_unlock_sender(OMTSender *sender)
+{
+    if (sender->wake_init)
+        pthread_mutex_unlock(&sender->lock);
+}
+
+/* Create the libomt sender and announce everything set up by the options. */
+static int omt_create_sender(AVFormatContext *avctx, OMTSender *sender, int quality)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+
+    av_log(avctx, AV_LOG_DEBUG, "calling omt_send_create for %s....\n", sender->name);
+    sender->omt_send = omt_send_create(sender->name, (OMTQuality)quality);
+    if (!sender->omt_send) {
+        av_log(avctx, AV_LOG_ERROR, "Failed to create OMT output %s\n", sender->name);
+        return AVERROR_EXTERNAL;
+    }
+
+    if (ctx->product_name || ctx->manufacturer || ctx->product_version) {
+        OMTSenderInfo info = { 0 };
+        av_strlcpy(info.ProductName,  ctx->product_name    ? ctx->product_name    : "", sizeof(info.ProductName));
+        av_strlcpy(info.Manufacturer, ctx->manufacturer    ? ctx->manufacturer    : "", sizeof(info.Manufacturer));
+        av_strlcpy(info.Version,      ctx->product_version ? ctx->product_version : "", sizeof(info.Version));
+        omt_send_setsenderinformation(sender->omt_send, &info);
+    }
+
+    if (ctx->connection_metadata)
+        omt_send_addconnectionmetadata(sender->omt_send, ctx->connection_metadata);
+
+    if (ctx->redirect_applied && *ctx->redirect_applied)
+        omt_send_setredirect(sender->omt_send, ctx->redirect_applied);
+
+    return 0;
+}
+
+static void omt_log_statistics(AVFormatContext *avctx, OMTSender *ctx, int level)
+{
+    OMTStatistics video, audio;
+
+    omt_send_getvideostatistics(ctx->omt_send, &video);
+    omt_send_getaudiostatistics(ctx->omt_send, &audio);
+
+    av_log(avctx, level, "%s: %d connections, video: %"PRId64" frames, %"PRId64" dropped, "
+           "%"PRId64" bytes (+%"PRId64"), codec %"PRId64" ms (%.2f ms/frame); "
+           "audio: %"PRId64" frames, %"PRId64" dropped, %"PRId64" bytes; "
+           "%"PRId64" frames skipped while idle\n",
+           ctx->name, omt_send_connections(ctx->omt_send),
+           video.Frames, video.FramesDropped, video.BytesSent, video.BytesSentSinceLast,
+           video.CodecTime, video.Frames ? (double)video.CodecTime / video.Frames : 0.0,
+           audio.Frames, audio.FramesDropped, audio.BytesSent,
+           ctx->nb_idle_skipped);
+}
+
+/*
+ * Poll the tally of the sender, report changes to the log and to the
+ * application, and switch the encoding quality when going on or off
+ * program if program_quality is set. libomt fixes the quality when the
+ * sender is created, so the sender is recreated, and its receivers
+ * reconnect, to switch it; the program state has to hold for
+ * OMT_QUALITY_SWITCH_HOLD first so that a flapping tally does not keep
+ * disconnecting them.
+ * Always called from the thread writing packets, so that the application
+ * receives AV_DEV_TO_APP_TALLY_CHANGED from its own thread.
+ */
+static int omt_poll_tally(AVFormatContext *avctx, OMTSender *ctx)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    int64_t now = av_gettime_relative();
+    OMTTally tally;
+
+    if (now - ctx->last_tally_poll < OMT_TALLY_POLL_INTERVAL)
+        return 0;
+    ctx->last_tally_poll = now;
+
+    if (omt_send_gettally(ctx->omt_send, 0, &tally) &&
+        (tally.program != ctx->tally.program || tally.preview != ctx->tally.preview)) {
+        int state[2] = { tally.program, tally.preview };
+
+        av_log(avctx, AV_LOG_INFO, "%s: tally program %s, preview %s\n", ctx->name,
+               tally.program ? "on" : "off", tally.preview ? "on" : "off");
+        avdevice_dev_to_app_control_message(avctx, AV_DEV_TO_APP_TALLY_CHANGED,
+                                            state, sizeof(state));
+
+        if (tally.program != ctx->tally.program)
+            ctx->tally_program_time = now;
+        ctx->tally = tally;
+    }
+
+    if (octx->program_quality >= 0 && !!ctx->tally.program != ctx->quality_program &&
+        now - ctx->tally_program_time >= OMT_QUALITY_SWITCH_HOLD) {
+        int quality = ctx->tally.program ? octx->program_quality : octx->quality;
+        int ret;
+
+        av_log(avctx, AV_LOG_INFO, "%s: switching to quality %d, receivers will reconnect\n",
+               ctx->name, quality);
+        omt_lock_sender(ctx);
+        omt_send_destroy(ctx->omt_send);
+        ret = omt_create_sender(avctx, ctx, quality);
+        omt_unlock_sender(ctx);
+        if (ret < 0)
+            return ret;
+        ctx->quality_program = !!ctx->tally.program;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns 0 if nothing should be sent because no receiver is connected and
+ * skip_idle is set; conversion and compression are then skipped entirely.
+ * Also prints the periodic statistics.
+ */
+static int omt_sender_active(AVFormatContext *avctx, OMTSender *ctx)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+
+    if (octx->stats_interval > 0) {
+        int64_t now = av_gettime_relative();
+        if (now - ctx->last_stats_time >= octx->stats_interval) {
+            omt_log_statistics(avctx, ctx, AV_LOG_INFO);
+            omt_log_latency(avctx, ctx, AV_LOG_INFO);
+            ctx->last_stats_time = now;
+        }
+    }
+
+    if (octx->skip_idle) {
+        int connected = omt_send_connections(ctx->omt_send) > 0;
+        if (connected != ctx->connected) {
+            av_log(avctx, AV_LOG_VERBOSE, "%s: %s\n", ctx->name,
+                   connected ? "receiver connected, sending" : "no receivers, idle");
+            ctx->connected = connected;
+            if (ctx->audio_fifo)
+                av_audio_fifo_reset(ctx->audio_fifo);
+        }
+        if (!connected) {
+            ctx->nb_idle_skipped++;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Sleep until an absolute time on the av_gettime_relative() clock. */
+static void omt_sleep_until(int64_t deadline)
+{
+#if HAVE_CLOCK_NANOSLEEP && defined(CLOCK_MONOTONIC)
+    if (av_gettime_relative_is_monotonic()) {
+        struct timespec ts = { deadline / 1000000, deadline % 1000000 * 1000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        return;
+    }
+#endif
+    deadline -= av_gettime_relative();
+    if (deadline > 0)
+        av_usleep(deadline);
+}
+
+/*
+ * Genlock video to a grid of frame slots on the monotonic clock, phase
+ * aligned to pacing_reference, so that all senders at the same frame rate
+ * send their frames at the same instants. Frames are assigned to slots by
+ * their pts, starting with the first slot at least pacing_latency after the
+ * first frame arrived. The arrival times are smoothed by a DLL which follows
+ * the drift between the source and the local clock: when the source runs
+ * slow and frames systematically miss their slot, the schedule is moved
+ * forward; frames which fall into an already used slot are dropped.
+ * Returns 0 if the frame must be dropped.
+ */
+static int omt_pace_video(AVFormatContext *avctx, OMTSender *ctx, AVStream *st, int64_t pts)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    double period = 1000000 * av_q2d(av_inv_q(st->avg_frame_rate));
+    double arrival, filtered;
+    int64_t slot, deadline, now;
+
+    arrival  = ctx->arrival_time / 1000000.0;
+    filtered = ff_timefilter_update(ctx->pace_filter, arrival, 1) * 1000000;
+    if (fabs(filtered - ctx->arrival_time) > 10 * period) {
+        /* the source stalled, start following it again */
+        ff_timefilter_reset(ctx->pace_filter);
+        filtered = ff_timefilter_update(ctx->pace_filter, arrival, 1) * 1000000;
+    }
+
+    /* Frames without a timestamp take the slot after the last one sent,
+     * or when there is none yet, the arrival time on the wall clock. */
+    if (pts != AV_NOPTS_VALUE)
+        pts = av_rescale_q(pts, st->time_base, AV_TIME_BASE_Q);
+    else if (ctx->pace_base_pts != AV_NOPTS_VALUE && ctx->last_slot != INT64_MIN)
+        pts = ctx->pace_base_pts + llrint((ctx->last_slot + 1 - ctx->pace_base_slot) * period);
+    else
+        pts = llrint(filtered);
+
+    if (ctx->pace_base_pts == AV_NOPTS_VALUE ||
+        fabs(pts - ctx->pace_base_pts - (ctx->last_slot - ctx->pace_base_slot) * period) > 10 * period) {
+        ctx->pace_base_pts  = pts;
+        ctx->pace_base_slot = ceil((filtered + octx->pacing_latency - octx->pacing_reference) / period);
+        ctx->last_slot      = INT64_MIN;
+    }
+    slot = ctx->pace_base_slot + llrint((pts - ctx->pace_base_pts) / period);
+
+    if (octx->pacing_reference + slot * period < filtered) {
+        int64_t skip = ceil((filtered + octx->pacing_latency - octx->pacing_reference) / period) - slot;
+        av_log(avctx, AV_LOG_DEBUG, "%s: source behind the output clock, skipping %"PRId64" slots\n",
+               ctx->name, skip);
+        ctx->pace_base_slot += skip;
+        slot += skip;
+    }
+
+    if (slot <= ctx->last_slot) {
+        av_log(avctx, AV_LOG_DEBUG, "%s: frame slot already used, dropping frame\n", ctx->name);
+        ctx->nb_dropped_pacing++;
+        return 0;
+    }
+
+    deadline = octx->pacing_reference + llrint(slot * period);
+    now = av_gettime_relative();
+    if (deadline < now)
+        av_log(avctx, AV_LOG_DEBUG, "%s: frame %"PRId64" us late\n", ctx->name, now - deadline);
+    else
+        omt_sleep_until(deadline);
+
+    ctx->last_slot = slot;
+    ctx->nb_paced++;
+    return 1;
+}
+
+static void omt_video_sent(AVFormatContext *avctx, OMTSender *ctx)
+{
+    if (ctx->repeating)
+        av_log(avctx, AV_LOG_INFO, "%s: video resumed, %"PRId64" frames repeated so far\n",
+               ctx->name, ctx->nb_repeated);
+    ctx->repeating       = 0;
+    ctx->last_video_time = av_gettime_relative();
+}
+
+static int omt_write_video_packet(AVFormatContext *avctx, OMTSender *ctx, AVStream *st, AVPacket *pkt)
 {
     av_log(avctx, AV_LOG_DEBUG, "omt_write_video_packet START.\n");
     
     int frameIsTenBitPlanar = 0;
-    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    OMTInflight inflight = { 0 };
+    char *metadata;
+    int ret;
+
+    if ((ret = omt_sender_active(avctx, ctx)) <= 0)
+        return ret;
+
+    if (octx->pacing && !omt_pace_video(avctx, ctx, st, pkt->pts))
+        return 0;
 
     if (st->codecpar->codec_id == AV_CODEC_ID_VMIX) {
         ctx->video.Codec = OMTCodec_VMX1;
@@ -183,6 +877,13 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
             ctx->video.Flags = OMTVideoFlags_Interlaced;
         else
              ctx->video.Flags = OMTVideoFlags_None;
+        /* VMX does not signal these itself, receivers rely on the flags */
+        if (st->codecpar->bits_per_raw_sample > 8)
+            ctx->video.Flags |= OMTVideoFlags_HighBitDepth;
+        if (st->codecpar->bits_per_coded_sample == 32 ||
+            (st->codecpar->format != AV_PIX_FMT_NONE &&
+             (av_pix_fmt_desc_get(st->codecpar->format)->flags & AV_PIX_FMT_FLAG_ALPHA)))
+            ctx->video.Flags |= OMTVideoFlags_Alpha;
         
         if (st->sample_aspect_ratio.num) {
             AVRational display_aspect_ratio;
@@ -195,15 +896,25 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
         else
             ctx->video.AspectRatio = (double)st->codecpar->width/st->codecpar->height;
 
-        ctx->video.ColorSpace = OMTColorSpace_BT709;
-        ctx->video.FrameMetadata = NULL;
-        ctx->video.FrameMetadataLength = 0 ;
+        ctx->video.ColorSpace = omt_color_space_from_av(st->codecpar->color_space);
         ctx->video.Timestamp = av_rescale_q(pkt->pts, st->time_base, OMT_TIME_BASE_Q);
         ctx->video.Type = OMTFrameType_Video;
         ctx->video.Codec = OMTCodec_VMX1;
         ctx->video.Stride = 0; 
-        ctx->video.Data = pkt->data;
-        ctx->video.DataLength = pkt->size;
+        inflight.pkt = av_packet_clone(pkt);
+        if (!inflight.pkt)
+            return AVERROR(ENOMEM);
+
+        ret = omt_build_frame_metadata(avctx, ctx, st, NULL, pkt, &metadata);
+        if (ret < 0) {
+            omt_inflight_unref(&inflight);
+            return ret;
+        }
+        inflight.metadata = metadata;
+        ctx->video.FrameMetadata = metadata;
+        ctx->video.FrameMetadataLength = metadata ? strlen(metadata) + 1 : 0;
+        ctx->video.Data = inflight.pkt->data;
+        ctx->video.DataLength = inflight.pkt->size;
         ctx->video.CompressedData = NULL;
         ctx->video.CompressedLength = 0;
  
@@ -211,7 +922,7 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
             __func__, pkt->pts, ctx->video.Timestamp, st->time_base.num, st->time_base.den);
 
 
-        if (ctx->clock_output == 1) 
+        if (octx->clock_output == 1) 
             ctx->video.Timestamp = -1;
       
            
@@ -219,14 +930,12 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
     
         dumpOMTMediaFrameInfo(avctx,&ctx->video);
         omt_send(ctx->omt_send, &ctx->video);
-    
-        ctx->last_avframe = NULL;
+        omt_video_sent(avctx, ctx);
+        omt_inflight_push(&ctx->video_inflight, &inflight);
+        if (octx->report_latency)
+            omt_update_latency(avctx, ctx, st, pkt);
         
         av_log(avctx, AV_LOG_DEBUG, "Compressed Data SENT %d bytes\n", ctx->video.CompressedLength);
-        for (int i=0;i<64;i++) {
-            av_log(avctx, AV_LOG_DEBUG, "%02x ",((uint8_t*)(ctx->video.Data))[i]);
-        }
-        av_log(avctx, AV_LOG_DEBUG, "\n");
 
     }
     else  {
@@ -265,7 +974,8 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
         else
             ctx->video.AspectRatio = (double)st->codecpar->width/st->codecpar->height;
 
-        ctx->video.ColorSpace = OMTColorSpace_BT709;
+        ctx->video.ColorSpace = omt_color_space_from_av(tmp->colorspace != AVCOL_SPC_UNSPECIFIED ?
+                                                        tmp->colorspace : st->codecpar->color_space);
         ctx->video.CompressedData = NULL;
         ctx->video.CompressedLength = 0;
         ctx->video.FrameMetadata = NULL;
@@ -289,7 +999,7 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
             return AVERROR(EINVAL);
         }
 
-        avframe = av_frame_clone(tmp);
+        inflight.frame = avframe = av_frame_clone(tmp);
         if (!avframe)
             return AVERROR(ENOMEM);
 
@@ -299,10 +1009,16 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
         ctx->video.DataLength = ctx->video.Stride * ctx->video.Height;    
             
         if (frameIsTenBitPlanar) {
-            convert_yuv422p10le_to_p216_PAD ((uint16_t*)avframe->data[0],avframe->linesize[0], (uint16_t*)avframe->data[1],avframe->linesize[1], ( uint16_t*)avframe->data[2], avframe->linesize[2],
-            (uint16_t*)(ctx->uyvyflip[ctx->whichFlipBuff]),ctx->video.Stride,ctx->video.Width, ctx->video.Height);
-            ctx->video.Data  = (void *)ctx->uyvyflip[ctx->whichFlipBuff];
-            ctx->whichFlipBuff = !ctx->whichFlipBuff;
+            /* P216 has a second, interleaved chroma plane of the same size */
+            ctx->video.DataLength *= 2;
+            inflight.buf = omt_pool_get(&ctx->video_pool, &ctx->video_pool_size,
+                                        2 * (size_t)ctx->video.Stride * ctx->video.Height);
+            if (!inflight.buf) {
+                omt_inflight_unref(&inflight);
+                return AVERROR(ENOMEM);
+            }
+            omt_convert_p216(ctx, avframe, inflight.buf->data);
+            ctx->video.Data  = (void *)inflight.buf->data;
         }
         else
              ctx->video.Data = (void *)(avframe->data[0]); 
@@ -310,119 +1026,652 @@ static int omt_write_video_packet(AVFormatContext *avctx, AVStream *st, AVPacket
         av_log(avctx, AV_LOG_DEBUG, "%s: pkt->pts=%"PRId64", timecode=%"PRId64", st->time_base=%d/%d\n",
             __func__, pkt->pts, ctx->video.Timestamp, st->time_base.num, st->time_base.den);
 
-        if (ctx->clock_output == 1)
+        if (octx->clock_output == 1)
             ctx->video.Timestamp = -1;
+
+        ret = omt_build_frame_metadata(avctx, ctx, st, avframe, pkt, &metadata);
+        if (ret < 0) {
+            omt_inflight_unref(&inflight);
+            return ret;
+        }
+        inflight.metadata = metadata;
+        ctx->video.FrameMetadata = metadata;
+        ctx->video.FrameMetadataLength = metadata ? strlen(metadata) + 1 : 0;
            
         av_log(avctx, AV_LOG_DEBUG, "omt_send \n");
     
         dumpOMTMediaFrameInfo(avctx,&ctx->video);
         omt_send(ctx->omt_send, &ctx->video);
-    
-        av_frame_free(&ctx->last_avframe);
-        ctx->last_avframe = avframe;
+        omt_video_sent(avctx, ctx);
+        omt_inflight_push(&ctx->video_inflight, &inflight);
+        if (octx->report_latency)
+            omt_update_latency(avctx, ctx, st, pkt);
     }
     return 0;
 }
 
 /*
-Convert interleaved int16_t (in a uint8_t buffer) to planar float (per-channel contiguous).
-'interleaveShortData' is interleaved shorts (uint8_t * pointing to int16_t data).
-'planarFloatData' is planar float (per channel, NSamples per channel).
-Returns number of output floats written (should be sourceChannels*sourceSamplesPerChannel).
+Convert interleaved or planar s16/s32/flt samples to planar float (per-channel contiguous).
+'src' holds one pointer for interleaved formats and one per channel for planar ones.
+'planarFloatData' receives sourceSamplesPerChannel floats for each channel in turn.
 */
-static int convertInterleavedShortsToPlanarFloat(uint8_t *interleaveShortData,
-                                                   int sourceChannels,
-                                                   int sourceSamplesPerChannel,
-                                                   float *planarFloatData,
-                                                   float referenceLevel)
+static void convertSamplesToPlanarFloat(const uint8_t * const *src,
+                                        enum AVSampleFormat format,
+                                        int sourceChannels,
+                                        int sourceSamplesPerChannel,
+                                        float *planarFloatData,
+                                        float referenceLevel)
 {
-    const int16_t *in = (const int16_t *)interleaveShortData;
-    int totalSamples = sourceChannels * sourceSamplesPerChannel;
-    for (int sampleIdx = 0; sampleIdx < sourceSamplesPerChannel; ++sampleIdx) {
-        for (int ch = 0; ch < sourceChannels; ++ch) {
-            // Interleaved order: [ch0sam0][ch1sam0]...[chNsam0][ch0sam1]...
-            int srcIdx = sampleIdx * sourceChannels + ch;
-            int16_t sample = in[srcIdx];
-            // Convert int16 sample to float in [-1,1],
-            // then rescale by referenceLevel. (referenceLevel==1.0f: full range.)
-            float val = (float)sample / 32767.0f * referenceLevel;
-            // Planar output index
-            int dstIdx = ch * sourceSamplesPerChannel + sampleIdx;
-            planarFloatData[dstIdx] = val;
+    const int planar = av_sample_fmt_is_planar(format);
+    const int step = planar ? 1 : sourceChannels;
+
+    for (int ch = 0; ch < sourceChannels; ++ch) {
+        const uint8_t *in = planar ? src[ch] : src[0];
+        const int offset = planar ? 0 : ch;
+        float *out = planarFloatData + ch * sourceSamplesPerChannel;
+
+        // Convert each sample to float in [-1,1],
+        // then rescale by referenceLevel. (referenceLevel==1.0f: full range.)
+        switch (av_get_packed_sample_fmt(format)) {
+        case AV_SAMPLE_FMT_S16: {
+            const int16_t *s16 = (const int16_t *)in + offset;
+            for (int i = 0; i < sourceSamplesPerChannel; i++)
+                out[i] = s16[i * step] * (referenceLevel / 32767.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_S32: {
+            const int32_t *s32 = (const int32_t *)in + offset;
+            for (int i = 0; i < sourceSamplesPerChannel; i++)
+                out[i] = s32[i * step] * (referenceLevel / 2147483647.0f);
+            break;
+        }
+        case AV_SAMPLE_FMT_FLT: {
+            const float *flt = (const float *)in + offset;
+            for (int i = 0; i < sourceSamplesPerChannel; i++)
+                out[i] = flt[i * step] * referenceLevel;
+            break;
+        }
+        default:
+            av_assert0(0);
         }
     }
-    return totalSamples; // number of floats written
 }
 
-
-static int omt_write_audio_packet(AVFormatContext *avctx, AVStream *st, AVPacket *pkt)
+/*
+ * Send nb_samples of planar float audio from buf, which is kept in the
+ * in-flight ring.
+ */
+static void omt_send_audio(AVFormatContext *avctx, OMTSender *ctx,
+                           AVBufferRef *buf, int nb_samples, int64_t timestamp)
 {
-    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+
     ctx->audio.Type = OMTFrameType_Audio;
-    ctx->audio.Timestamp = av_rescale_q(pkt->pts, st->time_base, OMT_TIME_BASE_Q);
-    ctx->audio.SamplesPerChannel = pkt->size / (ctx->audio.Channels << 1);
-    ctx->audio.DataLength = sizeof(float) * convertInterleavedShortsToPlanarFloat((uint8_t *)pkt->data, ctx->audio.Channels, ctx->audio.SamplesPerChannel, ctx->floataudio,ctx->reference_level);
-    ctx->audio.Data = (short *)ctx->floataudio;
+    ctx->audio.Timestamp = octx->clock_output == 1 ? -1 : timestamp;
+    ctx->audio.SamplesPerChannel = nb_samples;
+    ctx->audio.DataLength = nb_samples * ctx->audio.Channels * sizeof(float);
+    ctx->audio.Data = buf->data;
 
-    av_log(avctx, AV_LOG_DEBUG, "%s: pkt->pts=%"PRId64", timecode=%"PRId64", st->time_base=%d/%d\n",
-        __func__, pkt->pts, ctx->audio.Timestamp, st->time_base.num, st->time_base.den);
+    omt_send(ctx->omt_send,&ctx->audio);
+    ctx->audio_next_ts = timestamp + av_rescale(nb_samples, OMT_TIME_BASE, ctx->audio.SampleRate);
 
-    if (ctx->clock_output == 1)
-         ctx->audio.Timestamp = -1;
+    omt_inflight_push(&ctx->audio_inflight, &(OMTInflight){ .buf = buf });
+}
 
-    omt_send(ctx->omt_send,&ctx->audio);
+/*
+ * Size of the next re-blocked audio frame: either fixed, or the number of
+ * samples spanned by the next video frame, which yields the usual
+ * 1602/1601/1602/1601/1602 sequence for 48 kHz at 30000/1001.
+ */
+static int omt_audio_block_size(AVFormatContext *avctx, OMTSender *ctx)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    AVRational fr;
+    int64_t scale;
+
+    if (octx->audio_frame_size > 0)
+        return octx->audio_frame_size;
+
+    fr    = ctx->video_st->avg_frame_rate;
+    scale = (int64_t)ctx->audio.SampleRate * fr.den;
+    return av_rescale(ctx->audio_blocks + 1, scale, fr.num) -
+           av_rescale(ctx->audio_blocks,     scale, fr.num);
+}
+
+static int omt_send_audio_blocks(AVFormatContext *avctx, OMTSender *ctx, int flush)
+{
+    int block;
+
+    while ((block = omt_audio_block_size(avctx, ctx)) <= av_audio_fifo_size(ctx->audio_fifo) ||
+           (flush && av_audio_fifo_size(ctx->audio_fifo) > 0)) {
+        void *planes[OMT_MAX_AUDIO_CHANNELS];
+        AVBufferRef *buf;
+        int nb_samples = FFMIN(block, av_audio_fifo_size(ctx->audio_fifo));
+
+        buf = omt_pool_get(&ctx->audio_pool, &ctx->audio_pool_size, (size_t)block * ctx->audio.Channels * sizeof(float));
+        if (!buf)
+            return AVERROR(ENOMEM);
+        for (int ch = 0; ch < ctx->audio.Channels; ch++)
+            planes[ch] = buf->data + ch * nb_samples * sizeof(float);
+        av_audio_fifo_read(ctx->audio_fifo, planes, nb_samples);
+
+        omt_send_audio(avctx, ctx, buf, nb_samples,
+                       av_rescale_q(ctx->audio_fifo_pts, (AVRational){ 1, ctx->audio.SampleRate },
+                                    OMT_TIME_BASE_Q));
+        ctx->audio_fifo_pts += nb_samples;
+        ctx->audio_blocks++;
+    }
 
     return 0;
 }
 
-static int omt_write_packet(AVFormatContext *avctx, AVPacket *pkt)
+static int omt_write_audio_packet(AVFormatContext *avctx, OMTSender *ctx, AVStream *st,
+                                  AVPacket *pkt, int is_frame)
 {
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    const AVFrame *frame = NULL;
+    AVBufferRef *buf;
+    const uint8_t *planes[OMT_MAX_AUDIO_CHANNELS];
+    const uint8_t * const *src = planes;
+    enum AVSampleFormat format = ctx->audio_fmt;
+    int nb_samples;
+    int64_t timestamp;
+    size_t size;
+    int ret;
+
+    if ((ret = omt_sender_active(avctx, ctx)) <= 0)
+        return ret;
+
+    if (is_frame || st->codecpar->codec_id == AV_CODEC_ID_WRAPPED_AVFRAME) {
+        frame = (const AVFrame *)pkt->data;
+        if (frame->ch_layout.nb_channels != ctx->audio.Channels ||
+            frame->sample_rate != ctx->audio.SampleRate) {
+            av_log(avctx, AV_LOG_ERROR, "Audio parameters changed mid-stream, not supported.\n");
+            return AVERROR(EINVAL);
+        }
+        format     = frame->format;
+        nb_samples = frame->nb_samples;
+        src        = (const uint8_t * const *)frame->extended_data;
+    } else {
+        const int sample_size = av_get_bytes_per_sample(format);
+        nb_samples = pkt->size / (ctx->audio.Channels * sample_size);
+        for (int ch = 0; ch < ctx->audio.Channels; ch++)
+            planes[ch] = pkt->data + (av_sample_fmt_is_planar(format) ? ch * nb_samples * sample_size : 0);
+    }
 
-    av_log(avctx, AV_LOG_DEBUG, "omt_write_packet.\n");
-    AVStream *st = avctx->streams[pkt->stream_index];
-    
-    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
-        return omt_write_video_packet(avctx, st, pkt);
-    else if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
-        return omt_write_audio_packet(avctx, st, pkt);
+    size = (size_t)nb_samples * ctx->audio.Channels * sizeof(float);
+    if (!nb_samples || size > INT_MAX)
+        return AVERROR(EINVAL);
+
+    if (ctx->audio_fifo) {
+        int ret;
+
+        if (!av_audio_fifo_size(ctx->audio_fifo))
+            ctx->audio_fifo_pts = av_rescale_q(pkt->pts, st->time_base,
+                                               (AVRational){ 1, ctx->audio.SampleRate });
+
+        if (format == AV_SAMPLE_FMT_FLTP && octx->reference_level == 1.0f) {
+            ret = av_audio_fifo_write(ctx->audio_fifo, (void **)src, nb_samples);
+        } else {
+            void *fplanes[OMT_MAX_AUDIO_CHANNELS];
+
+            buf = omt_pool_get(&ctx->audio_pool, &ctx->audio_pool_size, size);
+            if (!buf)
+                return AVERROR(ENOMEM);
+            convertSamplesToPlanarFloat(src, format, ctx->audio.Channels, nb_samples,
+                                        (float *)buf->data, octx->reference_level);
+            for (int ch = 0; ch < ctx->audio.Channels; ch++)
+                fplanes[ch] = buf->data + ch * nb_samples * sizeof(float);
+            ret = av_audio_fifo_write(ctx->audio_fifo, fplanes, nb_samples);
+            av_buffer_unref(&buf);
+        }
+        if (ret < 0)
+            return ret;
+
+        return omt_send_audio_blocks(avctx, ctx, 0);
+    }
 
+    buf = omt_pool_get(&ctx->audio_pool, &ctx->audio_pool_size, size);
+    if (!buf)
+        return AVERROR(ENOMEM);
+    convertSamplesToPlanarFloat(src, format, ctx->audio.Channels, nb_samples,
+                                (float *)buf->data, octx->reference_level);
+
+    timestamp = av_rescale_q(pkt->pts, st->time_base, OMT_TIME_BASE_Q);
+
+    av_log(avctx, AV_LOG_DEBUG, "%s: pkt->pts=%"PRId64", timecode=%"PRId64", st->time_base=%d/%d\n",
+        __func__, pkt->pts, timestamp, st->time_base.num, st->time_base.den);
+
+    omt_send_audio(avctx, ctx, buf, nb_samples, timestamp);
+
+    return 0;
+}
+
+/* Data stream packets are UTF-8 XML, sent as OMT metadata frames. */
+static int omt_write_data_packet(AVFormatContext *avctx, OMTSender *ctx, AVStream *st, AVPacket *pkt)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    OMTMediaFrame meta = { 0 };
+    int size = pkt->size;
+    char *xml;
+    int ret;
+
+    while (size > 0 && !pkt->data[size - 1])
+        size--;
+    if (!size)
+        return 0;
+
+    if ((ret = omt_sender_active(avctx, ctx)) <= 0)
+        return ret;
+
+    xml = av_strndup(pkt->data, size);
+    if (!xml)
+        return AVERROR(ENOMEM);
+
+    meta.Type       = OMTFrameType_Metadata;
+    meta.Timestamp  = octx->clock_output == 1 ? -1 :
+                      av_rescale_q(pkt->pts, st->time_base, OMT_TIME_BASE_Q);
+    meta.Data       = xml;
+    meta.DataLength = size + 1;
+
+    omt_send(ctx->omt_send, &meta);
+
+    av_freep(&ctx->last_metadata);
+    ctx->last_metadata = xml;
+
+    return 0;
+}
+
+static int omt_write_stream_packet(AVFormatContext *avctx, OMTSender *sender, AVStream *st,
+                                   AVPacket *pkt, int is_frame)
+{
+    switch (st->codecpar->codec_type) {
+    case AVMEDIA_TYPE_VIDEO: return omt_write_video_packet(avctx, sender, st, pkt);
+    case AVMEDIA_TYPE_AUDIO: return omt_write_audio_packet(avctx, sender, st, pkt, is_frame);
+    case AVMEDIA_TYPE_DATA:  return omt_write_data_packet(avctx, sender, st, pkt);
+    }
     return AVERROR_BUG;
 }
 
+static void omt_free_queue_entry(void *msg)
+{
+    OMTQueueEntry *entry = msg;
+    av_packet_free(&entry->pkt);
+}
+
+/*
+ * Time at which the last video frame must be sent again because the source
+ * stalled: repeat_timeout after the last frame, then every frame period, on
+ * the frame grid when pacing. INT64_MAX if there is nothing to repeat.
+ */
+static int64_t omt_next_repeat(AVFormatContext *avctx, OMTSender *ctx)
+{
+    struct OMTContext *octx = (struct OMTContext *)avctx->priv_data;
+    double period;
+    int64_t next;
+
+    if (!octx->repeat_timeout || !ctx->video_st || !ctx->last_video_time)
+        return INT64_MAX;
+
+    period = 1000000 * av_q2d(av_inv_q(ctx->video_st->avg_frame_rate));
+    next   = ctx->last_video_time + (ctx->repeating ? llrint(period) : octx->repeat_timeout);
+
+    if (ctx->pace_filter && ctx->last_slot != INT64_MIN) {
+        ctx->repeat_slot = ctx->last_slot + 1;
+        if (!ctx->repeating)
+            ctx->repeat_slot = FFMAX(ctx->repeat_slot,
+                                     ceil((next - octx->pacing_reference) / period));
+        next = octx->pacing_reference + llrint(ctx->repeat_slot * period);
+    }
+
+    return next;
+}
+
+/*
+ * Send the last video frame again, and silence of the same duration. The
+ * OMT frames still point at the data of the newest frames in the in-flight
+ * rings, so nothing is copied.
+ */
+static int omt_repeat_frame(AVFormatContext *avctx, OMTSender *ctx)
+{
+    AVRational duration = av_inv_q(ctx->video_st->avg_frame_rate);
+    int ret;
+
+    if (!ctx->repeating)
+        av_log(avctx, AV_LOG_WARNING, "%s: no video for %"PRId64" ms, repeating the last frame\n",
+               ctx->name, (av_gettime_relative() - ctx->last_video_time) / 1000);
+    ctx->repeating       = 1;
+    ctx->last_video_time = av_gettime_relative();
+    if (ctx->pace_filter)
+        ctx->last_slot = ctx->repeat_slot;
+
+    if ((ret = omt_sender_active(avctx, ctx)) <= 0)
+        return ret;
+
+    if (ctx->video.Timestamp != -1)
+        ctx->video.Timestamp += av_rescale_q(1, duration, OMT_TIME_BASE_Q);
+    omt_send(ctx->omt_send, &ctx->video);
+    ctx->nb_repeated++;
+
+    if (ctx->audio_st) {
+        int nb_samples = av_rescale_q(1, duration, (AVRational){ 1, ctx->audio.SampleRate });
+        size_t size = (size_t)nb_samples * ctx->audio.Channels * sizeof(float);
+        AVBufferRef *buf;
+
+        if (!ctx->silence || ctx->silence->size < size) {
+            av_buffer_unref(&ctx->silence);
+            ctx->silence = av_buffer_allocz(size);
+            if (!ctx->silence)
+                return AVERROR(ENOMEM);
+        }
+        buf = av_buffer_ref(ctx->silence);
+        if (!buf)
+            return AVERROR(ENOMEM);
+        omt_send_audio(avctx, ctx, buf, nb_samples, ctx->audio_next_ts);
+    }
+
+    return 0;
+}
+
+/*
+ * Receive the next queue entry, or return AVERROR(EAGAIN) when the last
+ * video frame is due to be repeated before one arrives.
+ */
+static int omt_wait_queue_entry(AVFormatContext *avctx, OMTSender *sender, OMTQueueEntry *entry)
+{
+    for (;;) {
+        int64_t seen, deadline, wait;
+        struct timespec ts;
+        int ret;
+
+        pthread_mutex_lock(&sender->lock);
+        seen = sender->wake_count;
+        pthread_mutex_unlock(&sender->lock);
+
+        ret = av_thread_message_queue_recv(sender->queue, entry, AV_THREAD_MESSAGE_NONBLOCK);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+
+        deadline = omt_next_repeat(avctx, sender);
+        wait     = deadline - av_gettime_relative();
+        if (wait <= 0)
+            return AVERROR(EAGAIN);
+
+        if (deadline != INT64_MAX) {
+            /* the condition variable waits on the real time clock */
+            wait += av_gettime();
+            ts.tv_sec  = wait / 1000000;
+            ts.tv_nsec = wait % 1000000 * 1000;
+        }
+
+        pthread_mutex_lock(&sender->lock);
+        while (sender->wake_count == seen && ret != ETIMEDOUT) {
+            if (deadline == INT64_MAX)
+                pthread_cond_wait(&sender->wake_cond, &sender->lock);
+            else
+                ret = pthread_cond_timedwait(&sender->wake_cond, &sender->lock, &ts);
+        }
+        pthread_mutex_unlock(&sender->lock);
+
+        if (ret == ETIMEDOUT && sender->wake_count == seen)
+            return AVERROR(EAGAIN);
+    }
+}
+
+static void *omt_send_thread(void *arg)
+{
+    OMTSender *sender = arg;
+    AVFormatContext *avctx = sender->avctx;
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    OMTQueueEntry entry;
+    int ret;
+
+    ff_thread_setname("omt-send");
+
+    for (;;) {
+        AVStream *st;
+
+        if (ctx->repeat_timeout) {
+            ret = omt_wait_queue_entry(avctx, sender, &entry);
+            if (ret == AVERROR(EAGAIN)) {
+                if ((ret = omt_repeat_frame(avctx, sender)) < 0)
+                    break;
+                continue;
+            }
+        } else {
+            ret = av_thread_message_queue_recv(sender->queue, &entry, 0);
+        }
+        if (ret < 0)
+            break;
+        st = avctx->streams[entry.pkt->stream_index];
+
+        if (ctx->late_threshold > 0 && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            av_gettime_relative() - entry.enqueue_time > ctx->late_threshold) {
+            av_log(avctx, AV_LOG_DEBUG, "%s: dropping late video frame, pts=%"PRId64"\n",
+                   sender->name, entry.pkt->pts);
+            sender->nb_dropped_late++;
+            omt_free_queue_entry(&entry);
+            continue;
+        }
+
+        sender->arrival_time = entry.enqueue_time;
+        ret = omt_write_stream_packet(avctx, sender, st, entry.pkt, entry.is_frame);
+        omt_free_queue_entry(&entry);
+
+        if (ret < 0)
+            break;
+        sender->nb_sent++;
+    }
+
+    /* unblock the muxer thread and make it return our error */
+    av_thread_message_queue_set_err_send(sender->queue, ret);
+
+    return NULL;
+}
+
+static int omt_queue_packet(AVFormatContext *avctx, OMTSender *sender, AVPacket *pkt, int is_frame)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    OMTQueueEntry entry, old;
+    unsigned flags = ctx->queue_overflow == OMT_OVERFLOW_BLOCK ? 0 : AV_THREAD_MESSAGE_NONBLOCK;
+    int depth, ret;
+
+    entry.pkt = av_packet_clone(pkt);
+    if (!entry.pkt)
+        return AVERROR(ENOMEM);
+    entry.enqueue_time = av_gettime_relative();
+    entry.is_frame     = is_frame;
+
+    while ((ret = av_thread_message_queue_send(sender->queue, &entry, flags)) == AVERROR(EAGAIN)) {
+        if (ctx->queue_overflow == OMT_OVERFLOW_DROP_NEW) {
+            omt_free_queue_entry(&entry);
+            sender->nb_dropped_overflow++;
+            return 0;
+        }
+        /* OMT_OVERFLOW_DROP_OLD: make room by discarding the oldest entry */
+        if (av_thread_message_queue_recv(sender->queue, &old, AV_THREAD_MESSAGE_NONBLOCK) >= 0) {
+            omt_free_queue_entry(&old);
+            sender->nb_dropped_overflow++;
+        }
+    }
+    if (ret < 0) {
+        omt_free_queue_entry(&entry);
+        return ret;
+    }
+
+    pthread_mutex_lock(&sender->lock);
+    sender->wake_count++;
+    pthread_cond_signal(&sender->wake_cond);
+    pthread_mutex_unlock(&sender->lock);
+
+    sender->nb_queued++;
+    depth = av_thread_message_queue_nb_elems(sender->queue);
+    sender->max_queue_depth = FFMAX(sender->max_queue_depth, depth);
+
+    return 0;
+}
 
-static int count_channels_from_mask(const AVChannelLayout *ch_layout) {
-    int count = 0;
-    uint64_t mask = ch_layout->u.mask;
+/*
+ * Point receivers of all senders at the address in the redirect option, or
+ * cancel the redirect if it is empty. The option may be changed at runtime
+ * with av_opt_set() on the muxer; it is picked up with the next packet.
+ */
+static int omt_update_redirect(AVFormatContext *avctx)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    const char *redirect = ctx->redirect ? ctx->redirect : "";
+    const char *applied  = ctx->redirect_applied ? ctx->redirect_applied : "";
 
-    while (mask) {
-        if (mask & 1)
-            count++;
-        mask >>= 1;
+    if (!strcmp(redirect, applied))
+        return 0;
+
+    if (*redirect)
+        av_log(avctx, AV_LOG_INFO, "Redirecting receivers to %s\n", redirect);
+    else
+        av_log(avctx, AV_LOG_INFO, "Redirect cancelled\n");
+    for (int i = 0; i < ctx->nb_senders; i++) {
+        omt_lock_sender(&ctx->senders[i]);
+        omt_send_setredirect(ctx->senders[i].omt_send, *redirect ? redirect : NULL);
     }
-    return count;
+
+    av_freep(&ctx->redirect_applied);
+    ctx->redirect_applied = av_strdup(redirect);
+
+    for (int i = 0; i < ctx->nb_senders; i++)
+        omt_unlock_sender(&ctx->senders[i]);
+
+    return ctx->redirect_applied ? 0 : AVERROR(ENOMEM);
+}
+
+static int omt_send_packet(AVFormatContext *avctx, AVPacket *pkt, int is_frame)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    AVStream *st = avctx->streams[pkt->stream_index];
+    OMTSender *sender = &ctx->senders[ctx->stream_sender[pkt->stream_index]];
+    int ret;
+
+    if ((ret = omt_update_redirect(avctx)) < 0)
+        return ret;
+    if ((ret = omt_poll_tally(avctx, sender)) < 0)
+        return ret;
+
+    if (ctx->send_thread)
+        return omt_queue_packet(avctx, sender, pkt, is_frame);
+
+    sender->arrival_time = av_gettime_relative();
+    return omt_write_stream_packet(avctx, sender, st, pkt, is_frame);
+}
+
+static int omt_write_packet(AVFormatContext *avctx, AVPacket *pkt)
+{
+    av_log(avctx, AV_LOG_DEBUG, "omt_write_packet.\n");
+    return omt_send_packet(avctx, pkt, 0);
 }
 
 
+static void omt_release_frame(void *opaque, uint8_t *data)
+{
+    AVFrame *frame = (AVFrame *)data;
+    av_frame_free(&frame);
+}
+
+/*
+ * Uncoded frames are wrapped into a packet the same way wrapped_avframe does,
+ * so that they share the packet path (and the send queue) with encoded input.
+ */
+static int omt_write_uncoded_frame(AVFormatContext *avctx, int stream_index,
+                                   AVFrame **frame, unsigned flags)
+{
+    const AVCodecParameters *par = avctx->streams[stream_index]->codecpar;
+    AVPacket *pkt;
+    int ret;
+
+    /* Compressed VMX and data streams only take packets. */
+    if (par->codec_type == AVMEDIA_TYPE_DATA || par->codec_id == AV_CODEC_ID_VMIX)
+        return AVERROR(EINVAL);
+    if (flags & AV_WRITE_UNCODED_FRAME_QUERY)
+        return 0;
+
+    pkt = av_packet_alloc();
+    if (!pkt)
+        return AVERROR(ENOMEM);
+
+    pkt->buf = av_buffer_create((uint8_t *)*frame, sizeof(**frame), omt_release_frame,
+                                NULL, AV_BUFFER_FLAG_READONLY);
+    if (!pkt->buf) {
+        av_packet_free(&pkt);
+        return AVERROR(ENOMEM);
+    }
+    pkt->data         = pkt->buf->data;
+    pkt->size         = pkt->buf->size;
+    pkt->pts          = pkt->dts = (*frame)->pts;
+    pkt->duration     = (*frame)->duration;
+    pkt->stream_index = stream_index;
+    *frame = NULL;  // owned by pkt->buf now
+
+    ret = omt_send_packet(avctx, pkt, 1);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static enum AVSampleFormat omt_audio_codec_to_sample_fmt(const AVCodecParameters *c)
+{
+    switch (c->codec_id) {
+    case AV_CODEC_ID_PCM_S16LE:        return AV_SAMPLE_FMT_S16;
+    case AV_CODEC_ID_PCM_S16LE_PLANAR: return AV_SAMPLE_FMT_S16P;
+    case AV_CODEC_ID_PCM_S32LE:        return AV_SAMPLE_FMT_S32;
+    case AV_CODEC_ID_PCM_S32LE_PLANAR: return AV_SAMPLE_FMT_S32P;
+    case AV_CODEC_ID_PCM_F32LE:        return AV_SAMPLE_FMT_FLT;
+    default:                           return AV_SAMPLE_FMT_NONE;
+    }
+}
 
-static int omt_setup_audio(AVFormatContext *avctx, AVStream *st)
+static int omt_setup_audio(AVFormatContext *avctx, OMTSender *ctx, AVStream *st)
 {
     av_log(avctx, AV_LOG_DEBUG, "omt_setup_audio.\n");
     
-    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
     AVCodecParameters *c = st->codecpar;
 
-    if (ctx->audio.Type != 0) {
-        av_log(avctx, AV_LOG_ERROR, "Only one audio stream is supported!\n");
+    if (ctx->audio_st) {
+        av_log(avctx, AV_LOG_ERROR, "Only one audio stream per OMT sender is supported!\n");
+        return AVERROR(EINVAL);
+    }
+    ctx->audio_st = st;
+
+    ctx->audio_fmt = omt_audio_codec_to_sample_fmt(c);
+    if (ctx->audio_fmt == AV_SAMPLE_FMT_NONE) {
+        if (c->codec_id != AV_CODEC_ID_WRAPPED_AVFRAME) {
+            av_log(avctx, AV_LOG_ERROR, "Unsupported audio codec %s!"
+                   " Only pcm_s16le, pcm_s16le_planar, pcm_s32le, pcm_s32le_planar, pcm_f32le"
+                   " and wrapped_avframe are supported.\n", avcodec_get_name(c->codec_id));
+            return AVERROR(EINVAL);
+        }
+        /* uncoded frames only need a sample format we can convert */
+        switch (c->format) {
+        case AV_SAMPLE_FMT_S16: case AV_SAMPLE_FMT_S16P:
+        case AV_SAMPLE_FMT_S32: case AV_SAMPLE_FMT_S32P:
+        case AV_SAMPLE_FMT_FLT: case AV_SAMPLE_FMT_FLTP:
+            ctx->audio_fmt = c->format;
+            break;
+        default:
+            av_log(avctx, AV_LOG_ERROR, "Unsupported sample format %s!"
+                   " Only s16(p), s32(p) and flt(p) frames are supported.\n",
+                   av_get_sample_fmt_name(c->format));
+            return AVERROR(EINVAL);
+        }
+    }
+
+    if (c->ch_layout.nb_channels < 1 || c->ch_layout.nb_channels > OMT_MAX_AUDIO_CHANNELS) {
+        av_log(avctx, AV_LOG_ERROR, "Unsupported number of audio channels %d, at most %d are supported.\n",
+               c->ch_layout.nb_channels, OMT_MAX_AUDIO_CHANNELS);
         return AVERROR(EINVAL);
     }
 
     memset(&ctx->audio,0,sizeof(ctx->audio));
 
+    ctx->audio.Codec = OMTCodec_FPA1;
     ctx->audio.SampleRate = c->sample_rate;
-    ctx->audio.Channels = count_channels_from_mask(&c->ch_layout);
-
-    // buffer for conversion from int to float
-    ctx->floataudio = (float *)av_malloc(6144000); // 1/2 second at 32ch floats
+    ctx->audio.Channels = c->ch_layout.nb_channels;
 
     ctx->audio.CompressedData = NULL;
     ctx->audio.CompressedLength = 0;
@@ -436,15 +1685,14 @@ static int omt_setup_audio(AVFormatContext *avctx, AVStream *st)
     return 0;
 }
 
-static int omt_setup_video(AVFormatContext *avctx, AVStream *st)
+static int omt_setup_video(AVFormatContext *avctx, OMTSender *ctx, AVStream *st)
 {
     av_log(avctx, AV_LOG_DEBUG, "omt_setup_video avctx->priv_data=%llu\n", (unsigned long long) avctx->priv_data);
 
-    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
     AVCodecParameters *c = st->codecpar;
 
-    if (ctx->video.Type != 0) {
-        av_log(avctx, AV_LOG_ERROR, "Only one video stream is supported!\n");
+    if (ctx->video_st) {
+        av_log(avctx, AV_LOG_ERROR, "Only one video stream per OMT sender is supported!\n");
         return AVERROR(EINVAL);
     }
     
@@ -475,6 +1723,7 @@ static int omt_setup_video(AVFormatContext *avctx, AVStream *st)
     }
 
     memset(&ctx->video,0,sizeof(ctx->video));
+    ctx->video_st = st;
 
     switch(c->format) 
     {
@@ -484,9 +1733,6 @@ static int omt_setup_video(AVFormatContext *avctx, AVStream *st)
             
         case AV_PIX_FMT_YUV422P10LE:
             ctx->video.Codec = OMTCodec_P216;
-            ctx->uyvyflip[0] = (uint8_t*)av_malloc(c->width*c->height*8); // in theory 4 should be enough
-            ctx->uyvyflip[1] = (uint8_t*)av_malloc(c->width*c->height*8);
-            ctx->whichFlipBuff = 0;
         break;
         
         case AV_PIX_FMT_UYVY422:
@@ -518,11 +1764,22 @@ static int omt_setup_video(AVFormatContext *avctx, AVStream *st)
     else
         ctx->video.AspectRatio = (double)st->codecpar->width/st->codecpar->height;
 
-    ctx->video.ColorSpace = OMTColorSpace_BT709;
+    ctx->video.ColorSpace = omt_color_space_from_av(c->color_space);
     ctx->video.CompressedData = NULL;
     ctx->video.CompressedLength = 0;
     ctx->video.FrameMetadata = NULL;
     ctx->video.FrameMetadataLength = 0 ;
+
+    if (ctx->video.Codec != OMTCodec_BGRA) {
+        if (c->color_space != AVCOL_SPC_UNSPECIFIED &&
+            ctx->video.ColorSpace == OMTColorSpace_Undefined)
+            av_log(avctx, AV_LOG_WARNING, "Colour space %s cannot be signalled by OMT, "
+                   "receivers will assume BT.%d\n", av_color_space_name(c->color_space),
+                   c->height < 720 ? 601 : 709);
+        if (c->color_range == AVCOL_RANGE_JPEG)
+            av_log(avctx, AV_LOG_WARNING, "OMT carries limited range YUV, "
+                   "full range input will be displayed incorrectly\n");
+    }
     
     avpriv_set_pts_info(st, 64, 1, OMT_TIME_BASE);
 
@@ -531,25 +1788,181 @@ static int omt_setup_video(AVFormatContext *avctx, AVStream *st)
     return 0;
 }
 
+static int omt_write_trailer(AVFormatContext *avctx)
+{
+     av_log(avctx, AV_LOG_DEBUG, "omt_write_trailer.\n");
+
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+
+    for (int i = 0; i < ctx->nb_senders; i++) {
+        OMTSender *sender = &ctx->senders[i];
+
+        omt_stop_send_thread(sender);
+
+        if (sender->audio_fifo) {
+            if (sender->omt_send)
+                omt_send_audio_blocks(avctx, sender, 1);
+            av_audio_fifo_free(sender->audio_fifo);
+            sender->audio_fifo = NULL;
+        }
+
+        if (sender->pace_filter) {
+            av_log(avctx, AV_LOG_VERBOSE, "%s: %"PRId64" frames paced, %"PRId64" dropped by the pacer\n",
+                   sender->name, sender->nb_paced, sender->nb_dropped_pacing);
+            ff_timefilter_destroy(sender->pace_filter);
+            sender->pace_filter = NULL;
+        }
+
+        avpriv_slicethread_free(&sender->slicethread);
+        omt_log_latency(avctx, sender, AV_LOG_INFO);
+
+        if (sender->omt_send) {
+            omt_log_statistics(avctx, sender, AV_LOG_VERBOSE);
+            omt_send_destroy(sender->omt_send);
+            sender->omt_send = NULL;
+        }
+        if (sender->nb_repeated)
+            av_log(avctx, AV_LOG_VERBOSE, "%s: %"PRId64" frames repeated\n",
+                   sender->name, sender->nb_repeated);
+
+        omt_inflight_free(&sender->video_inflight);
+        omt_inflight_free(&sender->audio_inflight);
+        av_freep(&sender->last_metadata);
+        av_buffer_unref(&sender->silence);
+        av_buffer_pool_uninit(&sender->audio_pool);
+        av_buffer_pool_uninit(&sender->video_pool);
+        av_freep(&sender->name);
+    }
+    av_freep(&ctx->senders);
+    av_freep(&ctx->stream_sender);
+    av_freep(&ctx->redirect_applied);
+    ctx->nb_senders = 0;
+ 
+    return 0;
+}
+
+/*
+ * Group the streams into senders. Streams belonging to an output program
+ * (-program in ffmpeg) share a sender; otherwise the n-th video stream is
+ * paired with the n-th audio stream.
+ */
+static int omt_map_streams(AVFormatContext *avctx)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    int nb_video = 0, nb_audio = 0, nb_data = 0;
+
+    ctx->stream_sender = av_malloc_array(avctx->nb_streams, sizeof(*ctx->stream_sender));
+    if (!ctx->stream_sender)
+        return AVERROR(ENOMEM);
+    for (unsigned n = 0; n < avctx->nb_streams; n++)
+        ctx->stream_sender[n] = -1;
+
+    for (unsigned p = 0; p < avctx->nb_programs; p++) {
+        const AVProgram *program = avctx->programs[p];
+        for (unsigned n = 0; n < program->nb_stream_indexes; n++) {
+            unsigned idx = program->stream_index[n];
+            if (idx < avctx->nb_streams && ctx->stream_sender[idx] < 0)
+                ctx->stream_sender[idx] = ctx->nb_senders;
+        }
+        ctx->nb_senders++;
+    }
+
+    for (unsigned n = 0; n < avctx->nb_streams; n++) {
+        enum AVMediaType type = avctx->streams[n]->codecpar->codec_type;
+        int *count;
+
+        if (ctx->stream_sender[n] >= 0)
+            continue;
+        if (type == AVMEDIA_TYPE_VIDEO)
+            count = &nb_video;
+        else if (type == AVMEDIA_TYPE_AUDIO)
+            count = &nb_audio;
+        else if (type == AVMEDIA_TYPE_DATA)
+            count = &nb_data;
+        else {
+            av_log(avctx, AV_LOG_ERROR, "Unsupported stream type.\n");
+            return AVERROR(EINVAL);
+        }
+        ctx->stream_sender[n] = avctx->nb_programs + (*count)++;
+    }
+    ctx->nb_senders = FFMAX(ctx->nb_senders, avctx->nb_programs + FFMAX3(nb_video, nb_audio, nb_data));
+
+    ctx->senders = av_calloc(ctx->nb_senders, sizeof(*ctx->senders));
+    if (!ctx->senders)
+        return AVERROR(ENOMEM);
+
+    return 0;
+}
+
+static char *omt_sender_name(AVFormatContext *avctx, int index)
+{
+    struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;
+    const AVDictionaryEntry *title = NULL;
+    char buf[1024];
+
+    if (index < avctx->nb_programs)
+        title = av_dict_get(avctx->programs[index]->metadata, "title", NULL, 0);
+    if (title)
+        return av_strdup(title->value);
+
+    if (ctx->name_template) {
+        if (av_get_frame_filename2(buf, sizeof(buf), ctx->name_template, index + 1, 0) < 0) {
+            av_log(avctx, AV_LOG_ERROR, "Invalid name_template '%s'\n", ctx->name_template);
+            return NULL;
+        }
+        return av_strdup(buf);
+    }
+
+    if (ctx->nb_senders == 1)
+        return av_strdup(avctx->url);
+    return av_asprintf("%s %d", avctx->url, index + 1);
+}
+
 static int omt_write_header(AVFormatContext *avctx)
 {
-    int ret = 0;
+    int ret = 0, convert_threads;
     unsigned int n;
+    char address[OMT_MAX_STRING_LENGTH];
+    const AVDictionaryEntry *tcr;
     struct OMTContext *ctx = (struct OMTContext *)avctx->priv_data;    
     
     av_log(avctx, AV_LOG_DEBUG, "omt_write_header.\n");
+
+    if ((ret = omt_map_streams(avctx)) < 0)
+        goto error;
+
+    if (ctx->repeat_timeout && !ctx->send_thread) {
+        av_log(avctx, AV_LOG_ERROR, "repeat_timeout requires send_thread\n");
+        ret = AVERROR(EINVAL);
+        goto error;
+    }
+
+    if (ctx->pacing && ctx->clock_output) {
+        av_log(avctx, AV_LOG_WARNING, "clock_output is ignored when pacing is enabled\n");
+        ctx->clock_output = 0;
+    }
  
     /* check if streams compatible */
     for (n = 0; n < avctx->nb_streams; n++) {
         AVStream *st = avctx->streams[n];
         AVCodecParameters *c = st->codecpar;
+        OMTSender *sender = &ctx->senders[ctx->stream_sender[n]];
         if (c->codec_type == AVMEDIA_TYPE_AUDIO) {
-            if ((ret = omt_setup_audio(avctx, st)))
+            if ((ret = omt_setup_audio(avctx, sender, st)))
                 goto error;
         }
         else if (c->codec_type == AVMEDIA_TYPE_VIDEO) {
-            if ((ret = omt_setup_video(avctx, st)))
+            if ((ret = omt_setup_video(avctx, sender, st)))
+                goto error;
+        }
+        else if (c->codec_type == AVMEDIA_TYPE_DATA) {
+            if (sender->data_st) {
+                av_log(avctx, AV_LOG_ERROR, "Only one data stream per OMT sender is supported!\n");
+                ret = AVERROR(EINVAL);
                 goto error;
+            }
+            sender->data_st = st;
+            avpriv_set_pts_info(st, 64, 1, OMT_TIME_BASE);
         } 
         else {
             av_log(avctx, AV_LOG_ERROR, "Unsupported stream type.\n");
@@ -558,17 +1971,138 @@ static int omt_write_header(AVFormatContext *avctx)
         }
     }
 
-    av_log(avctx, AV_LOG_DEBUG, "calling omt_send_create....\n");
-    ctx->omt_send = omt_send_create(avctx->url, OMTQuality_Default);
-    if (!ctx->omt_send) {
-        av_log(avctx, AV_LOG_ERROR, "Failed to create OMT output %s\n", avctx->url);
-        ret = AVERROR_EXTERNAL;
+    /* Unless set, share the cores between the senders converting video, so
+     * that several programs do not start a thread per core each. */
+    convert_threads = ctx->convert_threads;
+    if (ctx->low_latency && !convert_threads) {
+        int nb_converting = 0;
+
+        for (n = 0; n < ctx->nb_senders; n++)
+            nb_converting += omt_sender_converts_video(&ctx->senders[n]);
+        convert_threads = FFMAX(av_cpu_count() / FFMAX(nb_converting, 1), 1);
+    }
+
+    for (n = 0; n < ctx->nb_senders; n++) {
+        OMTSender *sender = &ctx->senders[n];
+
+        sender->avctx = avctx;
+        sender->connected = 1;
+        sender->last_stats_time = av_gettime_relative();
+        sender->name = omt_sender_name(avctx, n);
+        if (!sender->name) {
+            ret = AVERROR(EINVAL);
+            goto error;
+        }
+
+        if ((ret = omt_create_sender(avctx, sender, ctx->quality)) < 0)
+            goto error;
+
+        if (omt_send_getaddress(sender->omt_send, address, sizeof(address)) > 0)
+            av_log(avctx, AV_LOG_VERBOSE, "Sending as %s\n", address);
+
+        if ((ret = omt_inflight_alloc(&sender->video_inflight, ctx->inflight_frames)) < 0 ||
+            (ret = omt_inflight_alloc(&sender->audio_inflight, ctx->inflight_frames)) < 0)
+            goto error;
+
+        if (ctx->pacing && sender->video_st) {
+            AVRational rate = sender->video_st->avg_frame_rate;
+
+            if (rate.num <= 0 || rate.den <= 0) {
+                av_log(avctx, AV_LOG_ERROR, "Pacing requires the video frame rate to be known\n");
+                ret = AVERROR(EINVAL);
+                goto error;
+            }
+            sender->pace_filter = ff_timefilter_new(av_q2d(av_inv_q(rate)), 1, OMT_PACING_BANDWIDTH);
+            if (!sender->pace_filter) {
+                ret = AVERROR(ENOMEM);
+                goto error;
+            }
+            sender->pace_base_pts = AV_NOPTS_VALUE;
+            sender->last_slot     = INT64_MIN;
+        }
+
+        if ((ctx->frame_metadata & OMT_METADATA_TIMECODE) && sender->video_st &&
+            ((tcr = av_dict_get(sender->video_st->metadata, "timecode", NULL, 0)) ||
+             (tcr = av_dict_get(avctx->metadata, "timecode", NULL, 0)))) {
+            if (av_timecode_init_from_string(&sender->timecode, sender->video_st->avg_frame_rate,
+                                             tcr->value, avctx) >= 0) {
+                sender->has_timecode = 1;
+                sender->timecode_pts = AV_NOPTS_VALUE;
+            } else {
+                av_log(avctx, AV_LOG_WARNING, "%s: ignoring start timecode %s\n",
+                       sender->name, tcr->value);
+            }
+        }
+
+        if (ctx->low_latency && omt_sender_converts_video(sender) && convert_threads > 1) {
+            ret = avpriv_slicethread_create(&sender->slicethread, sender,
+                                            omt_convert_p216_slice, NULL, convert_threads);
+            if (ret < 0)
+                goto error;
+            av_log(avctx, AV_LOG_VERBOSE, "%s: converting video with %d threads\n",
+                   sender->name, ret);
+        }
+
+        if (sender->audio_st && ctx->audio_frame_size) {
+            if (ctx->audio_frame_size < 0 &&
+                (!sender->video_st || !sender->video_st->avg_frame_rate.num ||
+                 !sender->video_st->avg_frame_rate.den)) {
+                av_log(avctx, AV_LOG_ERROR, "%s: audio_frame_size=video needs a video stream "
+                       "with a known frame rate\n", sender->name);
+                ret = AVERROR(EINVAL);
+                goto error;
+            }
+            sender->audio_fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, sender->audio.Channels,
+                                                     sender->audio.SampleRate / 10);
+            if (!sender->audio_fifo) {
+                ret = AVERROR(ENOMEM);
+                goto error;
+            }
+        }
+
+        if (ctx->repeat_timeout && sender->video_st) {
+            AVRational rate = sender->video_st->avg_frame_rate;
+
+            if (rate.num <= 0 || rate.den <= 0) {
+                av_log(avctx, AV_LOG_ERROR, "Repeating frames requires the video frame rate to be known\n");
+                ret = AVERROR(EINVAL);
+                goto error;
+            }
+        }
+
+        if (ctx->send_thread) {
+            ret = av_thread_message_queue_alloc(&sender->queue, ctx->queue_size, sizeof(OMTQueueEntry));
+            if (ret < 0)
+                goto error;
+            av_thread_message_queue_set_free_func(sender->queue, omt_free_queue_entry);
+
+            pthread_mutex_init(&sender->lock, NULL);
+            pthread_cond_init(&sender->wake_cond, NULL);
+            sender->wake_init = 1;
+
+            ret = pthread_create(&sender->thread, NULL, omt_send_thread, sender);
+            if (ret) {
+                av_log(avctx, AV_LOG_ERROR, "Failed to start send thread: %s\n", av_err2str(AVERROR(ret)));
+                ret = AVERROR(ret);
+                goto error;
+            }
+            sender->thread_started = 1;
+        }
+
+        av_log(avctx, AV_LOG_VERBOSE, "OMT sender %d: %s (video: %d, audio: %d)\n", n, sender->name,
+               sender->video_st ? sender->video_st->index : -1,
+               sender->audio_st ? sender->audio_st->index : -1);
     }
     
+    if ((ret = omt_update_redirect(avctx)) < 0)
+        goto error;
+
      av_log(avctx, AV_LOG_DEBUG, "libomt reference_level = %.2f clock_output = %d\n",ctx->reference_level,ctx->clock_output);
 
 
 error:
+    if (ret < 0)
+        omt_write_trailer(avctx);
 
     av_log(avctx, AV_LOG_DEBUG, "omt_write_header completed\n");
 
@@ -579,6 +2113,48 @@ error:
 static const AVOption options[] = {
     { "clock_output", "These specify whether the output 'clocks' itself"  , OFFSET(clock_output), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM },
     { "reference_level", "The audio reference level as floating point full scale deflection", OFFSET(reference_level), AV_OPT_TYPE_FLOAT, { .dbl = 1.0 }, 0.0, 20.0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_AUDIO_PARAM },
+    { "audio_frame_size", "Number of samples per channel in each audio frame sent", OFFSET(audio_frame_size), AV_OPT_TYPE_INT, { .i64 = 0 }, -1, 192000, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_AUDIO_PARAM, .unit = "audio_frame_size" },
+        { "passthrough", "Send audio as received",                  0, AV_OPT_TYPE_CONST, { .i64 =  0 }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_AUDIO_PARAM, .unit = "audio_frame_size" },
+        { "video",       "One audio frame per video frame duration", 0, AV_OPT_TYPE_CONST, { .i64 = -1 }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_AUDIO_PARAM, .unit = "audio_frame_size" },
+    { "name_template", "Name of each sender when several are created, %d is replaced by the sender number", OFFSET(name_template), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM },
+    { "frame_metadata", "Frame side data sent as per-frame XML metadata", OFFSET(frame_metadata), AV_OPT_TYPE_FLAGS, { .i64 = 0 }, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "frame_metadata" },
+        { "timecode", "SMPTE 12M timecode",                       0, AV_OPT_TYPE_CONST, { .i64 = OMT_METADATA_TIMECODE }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "frame_metadata" },
+        { "hdr",      "Mastering display and content light level", 0, AV_OPT_TYPE_CONST, { .i64 = OMT_METADATA_HDR },      0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "frame_metadata" },
+        { "captions", "ATSC A53 closed captions",                 0, AV_OPT_TYPE_CONST, { .i64 = OMT_METADATA_CAPTIONS }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "frame_metadata" },
+        { "sei",      "Unregistered SEI user data",               0, AV_OPT_TYPE_CONST, { .i64 = OMT_METADATA_SEI },      0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "frame_metadata" },
+    { "connection_metadata", "XML metadata sent to each receiver when it connects", OFFSET(connection_metadata), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM },
+    { "quality", "Video encoding quality", OFFSET(quality), AV_OPT_TYPE_INT, { .i64 = OMTQuality_Default }, 0, 100, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "quality" },
+        { "auto",   "Highest quality suggested by the receivers", 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Default }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "quality" },
+        { "low",    NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Low },    0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "quality" },
+        { "medium", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Medium }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "quality" },
+        { "high",   NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_High },   0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "quality" },
+    { "program_quality", "Video encoding quality while on program tally; switching recreates the sender, so its receivers drop and reconnect", OFFSET(program_quality), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 100, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "program_quality" },
+        { "off",    "Do not change the quality with the tally", 0, AV_OPT_TYPE_CONST, { .i64 = -1 }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "program_quality" },
+        { "auto",   NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Default }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "program_quality" },
+        { "low",    NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Low },     0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "program_quality" },
+        { "medium", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_Medium },  0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "program_quality" },
+        { "high",   NULL, 0, AV_OPT_TYPE_CONST, { .i64 = OMTQuality_High },    0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_VIDEO_PARAM, .unit = "program_quality" },
+    { "product_name", "Product name announced to receivers", OFFSET(product_name), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM },
+    { "manufacturer", "Manufacturer announced to receivers", OFFSET(manufacturer), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM },
+    { "product_version", "Product version announced to receivers", OFFSET(product_version), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM },
+    { "redirect", "Ask receivers to connect to this source instead, may be changed at runtime", OFFSET(redirect), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_RUNTIME_PARAM },
+    { "skip_idle", "Skip conversion and sending while no receiver is connected", OFFSET(skip_idle), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
+    { "stats_interval", "Print sender statistics at this interval (0 disables)", OFFSET(stats_interval), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "inflight_frames", "Number of sent frames whose data is kept alive for libomt; must cover how many frames libomt may still be reading, as it does not signal completion", OFFSET(inflight_frames), AV_OPT_TYPE_INT, { .i64 = 2 }, 1, 64, AV_OPT_FLAG_ENCODING_PARAM },
+    { "low_latency", "Convert video in horizontal slices on several threads to cut the time spent before each send", OFFSET(low_latency), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
+    { "convert_threads", "Threads converting the video of each sender with low_latency (0 = share the cores between the senders)", OFFSET(convert_threads), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "report_latency", "Measure the delay between capture and send of each video frame", OFFSET(report_latency), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
+    { "send_thread", "Send frames from a dedicated thread instead of the muxer thread", OFFSET(send_thread), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
+    { "queue_size", "Maximum number of packets queued for the send thread", OFFSET(queue_size), AV_OPT_TYPE_INT, { .i64 = 8 }, 1, 1024, AV_OPT_FLAG_ENCODING_PARAM },
+    { "queue_overflow", "What to do when the send queue is full", OFFSET(queue_overflow), AV_OPT_TYPE_INT, { .i64 = OMT_OVERFLOW_BLOCK }, 0, OMT_OVERFLOW_DROP_OLD, AV_OPT_FLAG_ENCODING_PARAM, .unit = "queue_overflow" },
+        { "block",    "Wait for the send thread",         0, AV_OPT_TYPE_CONST, { .i64 = OMT_OVERFLOW_BLOCK },    0, 0, AV_OPT_FLAG_ENCODING_PARAM, .unit = "queue_overflow" },
+        { "drop_new", "Drop the incoming packet",         0, AV_OPT_TYPE_CONST, { .i64 = OMT_OVERFLOW_DROP_NEW }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, .unit = "queue_overflow" },
+        { "drop_old", "Drop the oldest queued packet",    0, AV_OPT_TYPE_CONST, { .i64 = OMT_OVERFLOW_DROP_OLD }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM, .unit = "queue_overflow" },
+    { "pacing", "Send video frames at the frame rate of the stream, locked to the monotonic clock", OFFSET(pacing), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
+    { "pacing_reference", "Monotonic clock time in microseconds the frame grid is aligned to", OFFSET(pacing_reference), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "pacing_latency", "Delay between the arrival of a frame and its slot on the frame grid", OFFSET(pacing_latency), AV_OPT_TYPE_DURATION, { .i64 = 40000 }, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "repeat_timeout", "Repeat the last video frame and send silence when no frame arrived for this long (0 disables)", OFFSET(repeat_timeout), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "late_threshold", "Drop video frames that waited in the send queue longer than this (0 disables)", OFFSET(late_threshold), AV_OPT_TYPE_DURATION, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { NULL },
 };
 
@@ -606,6 +2182,7 @@ static const AVClass libomt_muxer_class = {
         .write_header     = omt_write_header,
         .write_packet     = omt_write_packet,
         .write_trailer    = omt_write_trailer,
+        .write_uncoded_frame = omt_write_uncoded_frame,
     };
 
 #else
@@ -622,6 +2199,7 @@ static const AVClass libomt_muxer_class = {
         .write_header   = omt_write_header,
         .write_packet   = omt_write_packet,
         .write_trailer  = omt_write_trailer,
+        .write_uncoded_frame = omt_write_uncoded_frame,
     };
 
 #endif
@@ -0,0 +1,644 @@
+/*
+ * libOMT loopback
+ * Copyright (c) 2025 Open Media Transport Contributors <omt@gallery.co.uk>
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * In-process implementation of the libomt API, used instead of the SDK when
+ * configured with --enable-libomt-loopback.
+ *
+ * Senders and receivers created in the same process are connected by
+ * address, without discovery or networking, so the libomt devices can be
+ * tested deterministically. Frames are copied to every connected receiver
+ * as they are sent. Video is never compressed: VMX1 frames only reach
+ * receivers asking for compressed video, uncompressed frames only the
+ * others, and 16-bit frames are reduced to UYVY for receivers that do not
+ * accept them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/error.h"
+#include "libavutil/macros.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#include "libomt.h"
+
+#define LOOPBACK_HOST       "LOOPBACK"
+#define LOOPBACK_QUEUE_SIZE 16
+
+typedef struct LoopbackFrame {
+    OMTMediaFrame f;
+    uint8_t *data;          // owns f.Data or f.CompressedData
+    char *metadata;         // owns f.FrameMetadata
+} LoopbackFrame;
+
+typedef struct LoopbackSender {
+    struct LoopbackSender *next;
+    char address[OMT_MAX_STRING_LENGTH];
+    OMTSenderInfo info;
+    char *connection_metadata;
+    char *redirect;
+    OMTTally tally;
+    OMTTally reported_tally;            // last returned by omt_send_gettally()
+    OMTStatistics stats[2];             // video, audio
+    int64_t next_timestamp[2];          // for frames sent with Timestamp -1
+} LoopbackSender;
+
+typedef struct LoopbackReceiver {
+    struct LoopbackReceiver *next;
+    char address[OMT_MAX_STRING_LENGTH];
+    OMTPreferredVideoFormat format;
+    OMTReceiveFlags flags;
+    OMTTally tally;
+    int connected;                      // connection metadata was queued
+    LoopbackFrame queue[LOOPBACK_QUEUE_SIZE];
+    int queue_start, queue_count;
+    LoopbackFrame current;              // returned by the last omt_receive()
+    OMTStatistics stats[2];
+} LoopbackReceiver;
+
+static AVMutex lock = AV_MUTEX_INITIALIZER;
+static AVOnce cond_once = AV_ONCE_INIT;
+static AVCond cond;
+static LoopbackSender *senders;
+static LoopbackReceiver *receivers;
+static char **addresses;
+static int nb_addresses;
+
+static void loopback_init_cond(void)
+{
+    ff_cond_init(&cond, NULL);
+}
+
+static void loopback_frame_free(LoopbackFrame *frame)
+{
+    av_freep(&frame->data);
+    av_freep(&frame->metadata);
+    memset(&frame->f, 0, sizeof(frame->f));
+}
+
+static int stats_index(OMTFrameType type)
+{
+    return type == OMTFrameType_Audio;
+}
+
+static LoopbackSender *find_sender(const char *address)
+{
+    for (LoopbackSender *s = senders; s; s = s->next)
+        if (!strcmp(s->address, address))
+            return s;
+    return NULL;
+}
+
+/* Compressed-only receivers get VMX1 video, the others uncompressed video. */
+static int receiver_accepts(const LoopbackReceiver *r, const OMTMediaFrame *f)
+{
+    int compressed_only = r->flags & OMTReceiveFlags_CompressedOnly;
+
+    if (f->Type != OMTFrameType_Video)
+        return 1;
+    if (f->Codec == OMTCodec_VMX1)
+        return compressed_only;
+    return !compressed_only;
+}
+
+/*
+ * Copy a frame for a receiver, reducing 16-bit P216/PA16 video to UYVY if
+ * the receiver does not accept it.
+ */
+static int loopback_frame_copy(LoopbackFrame *dst, const OMTMediaFrame *src,
+                               const LoopbackReceiver *r)
+{
+    int to_uyvy = (src->Codec == OMTCodec_P216 || src->Codec == OMTCodec_PA16) &&
+                  r->format != OMTPreferredVideoFormat_UYVYorUYVAorP216orPA16 &&
+                  r->format != OMTPreferredVideoFormat_P216;
+    int size = src->DataLength;
+
+    dst->f = *src;
+    dst->f.CompressedData   = NULL;
+    dst->f.CompressedLength = 0;
+    dst->f.FrameMetadata    = NULL;
+    dst->f.FrameMetadataLength = 0;
+
+    if (to_uyvy) {
+        dst->f.Codec  = OMTCodec_UYVY;
+        dst->f.Stride = src->Width * 2;
+        dst->f.Flags &= ~OMTVideoFlags_HighBitDepth;
+        size = dst->f.Stride * src->Height;
+    }
+
+    dst->data = av_malloc(FFMAX(size, 1));
+    if (!dst->data)
+        return AVERROR(ENOMEM);
+
+    if (to_uyvy) {
+        const uint8_t *uv_plane = (const uint8_t *)src->Data + (size_t)src->Stride * src->Height;
+
+        for (int y = 0; y < src->Height; y++) {
+            const uint16_t *luma = (const uint16_t *)((const uint8_t *)src->Data + (size_t)y * src->Stride);
+            const uint16_t *uv   = (const uint16_t *)(uv_plane + (size_t)y * src->Stride);
+            uint8_t *d = dst->data + (size_t)y * dst->f.Stride;
+
+            for (int x = 0; x < src->Width; x += 2) {
+                *d++ = uv[x]        >> 8;
+                *d++ = luma[x]      >> 8;
+                *d++ = uv[x + 1]    >> 8;
+                *d++ = luma[x + 1]  >> 8;
+            }
+        }
+    } else if (size > 0) {
+        memcpy(dst->data, src->Data, size);
+    }
+
+    if (src->Type == OMTFrameType_Video && src->Codec == OMTCodec_VMX1) {
+        dst->f.Data             = NULL;
+        dst->f.DataLength       = 0;
+        dst->f.CompressedData   = dst->data;
+        dst->f.CompressedLength = size;
+    } else {
+        dst->f.Data       = dst->data;
+        dst->f.DataLength = size;
+    }
+
+    if (src->FrameMetadata && src->FrameMetadataLength > 0) {
+        dst->metadata = av_malloc(src->FrameMetadataLength);
+        if (!dst->metadata) {
+            loopback_frame_free(dst);
+            return AVERROR(ENOMEM);
+        }
+        memcpy(dst->metadata, src->FrameMetadata, src->FrameMetadataLength);
+        dst->f.FrameMetadata       = dst->metadata;
+        dst->f.FrameMetadataLength = src->FrameMetadataLength;
+    }
+
+    return 0;
+}
+
+/* Queue a frame for a receiver, dropping the oldest one if it is full. */
+static int loopback_queue(LoopbackReceiver *r, const OMTMediaFrame *f)
+{
+    LoopbackFrame *slot;
+    int ret;
+
+    if (r->queue_count == LOOPBACK_QUEUE_SIZE) {
+        loopback_frame_free(&r->queue[r->queue_start]);
+        r->queue_start = (r->queue_start + 1) % LOOPBACK_QUEUE_SIZE;
+        r->queue_count--;
+        r->stats[stats_index(f->Type)].FramesDropped++;
+    }
+
+    slot = &r->queue[(r->queue_start + r->queue_count) % LOOPBACK_QUEUE_SIZE];
+    if ((ret = loopback_frame_copy(slot, f, r)) < 0)
+        return ret;
+    r->queue_count++;
+    ff_cond_broadcast(&cond);
+    return 0;
+}
+
+static void loopback_queue_metadata(LoopbackReceiver *r, const char *xml)
+{
+    OMTMediaFrame f = { 0 };
+
+    f.Type       = OMTFrameType_Metadata;
+    f.Data       = (void *)xml;
+    f.DataLength = strlen(xml) + 1;
+    loopback_queue(r, &f);
+}
+
+/* Connection metadata is delivered to receivers once their sender appears. */
+static void loopback_connect(LoopbackSender *s)
+{
+    for (LoopbackReceiver *r = receivers; r; r = r->next) {
+        if (r->connected || strcmp(r->address, s->address))
+            continue;
+        r->connected = 1;
+        if (s->connection_metadata)
+            loopback_queue_metadata(r, s->connection_metadata);
+    }
+}
+
+static void loopback_update_tally(LoopbackSender *s)
+{
+    OMTTally tally = { 0 };
+
+    for (LoopbackReceiver *r = receivers; r; r = r->next) {
+        if (strcmp(r->address, s->address))
+            continue;
+        tally.program |= r->tally.program;
+        tally.preview |= r->tally.preview;
+    }
+    s->tally = tally;
+}
+
+static void loopback_deadline(struct timespec *ts, int timeout_ms)
+{
+    int64_t t = av_gettime() + timeout_ms * 1000LL;
+
+    ts->tv_sec  = t / 1000000;
+    ts->tv_nsec = t % 1000000 * 1000;
+}
+
+char **omt_discovery_getaddresses(int *count)
+{
+    int n = 0;
+
+    ff_mutex_lock(&lock);
+    for (int i = 0; i < nb_addresses; i++)
+        av_freep(&addresses[i]);
+    nb_addresses = 0;
+
+    for (LoopbackSender *s = senders; s; s = s->next)
+        n++;
+    if (av_reallocp_array(&addresses, FFMAX(n, 1), sizeof(*addresses)) >= 0) {
+        for (LoopbackSender *s = senders; s; s = s->next)
+            if ((addresses[nb_addresses] = av_strdup(s->address)))
+                nb_addresses++;
+    }
+    ff_mutex_unlock(&lock);
+
+    *count = nb_addresses;
+    return addresses;
+}
+
+omt_receive_t *omt_receive_create(const char *address, OMTFrameType frameTypes,
+                                  OMTPreferredVideoFormat format, OMTReceiveFlags flags)
+{
+    LoopbackReceiver *r = av_mallocz(sizeof(*r));
+    LoopbackSender *s;
+
+    if (!r)
+        return NULL;
+    ff_thread_once(&cond_once, loopback_init_cond);
+    av_strlcpy(r->address, address, sizeof(r->address));
+    r->format = format;
+    r->flags  = flags;
+
+    ff_mutex_lock(&lock);
+    r->next   = receivers;
+    receivers = r;
+    if ((s = find_sender(address)))
+        loopback_connect(s);
+    ff_mutex_unlock(&lock);
+
+    return (omt_receive_t *)r;
+}
+
+void omt_receive_destroy(omt_receive_t *instance)
+{
+    LoopbackReceiver *r = (LoopbackReceiver *)instance;
+    LoopbackSender *s;
+
+    ff_mutex_lock(&lock);
+    for (LoopbackReceiver **p = &receivers; *p; p = &(*p)->next) {
+        if (*p == r) {
+            *p = r->next;
+            break;
+        }
+    }
+    if ((s = find_sender(r->address)))
+        loopback_update_tally(s);
+    ff_mutex_unlock(&lock);
+
+    for (int i = 0; i < r->queue_count; i++)
+        loopback_frame_free(&r->queue[(r->queue_start + i) % LOOPBACK_QUEUE_SIZE]);
+    loopback_frame_free(&r->current);
+    av_free(r);
+}
+
+OMTMediaFrame *omt_receive(omt_receive_t *instance, OMTFrameType frameTypes, int timeoutMilliseconds)
+{
+    LoopbackReceiver *r = (LoopbackReceiver *)instance;
+    OMTMediaFrame *ret = NULL;
+    struct timespec deadline;
+
+    loopback_deadline(&deadline, timeoutMilliseconds);
+
+    ff_mutex_lock(&lock);
+    loopback_frame_free(&r->current);
+    for (;;) {
+        while (r->queue_count) {
+            LoopbackFrame *head = &r->queue[r->queue_start];
+
+            r->queue_start = (r->queue_start + 1) % LOOPBACK_QUEUE_SIZE;
+            r->queue_count--;
+            if (!(head->f.Type & frameTypes)) {
+                loopback_frame_free(head);
+                continue;
+            }
+            r->current = *head;
+            memset(head, 0, sizeof(*head));
+            ret = &r->current.f;
+            break;
+        }
+        if (ret || ff_cond_timedwait(&cond, &lock, &deadline))
+            break;
+    }
+    ff_mutex_unlock(&lock);
+
+    if (ret && ret->Type != OMTFrameType_Metadata) {
+        OMTStatistics *st = &r->stats[stats_index(ret->Type)];
+        int size = ret->DataLength + ret->CompressedLength;
+
+        st->BytesReceived          += size;
+        st->BytesReceivedSinceLast += size;
+        st->Frames++;
+        st->FramesSinceLast++;
+    }
+    return ret;
+}
+
+/* Metadata sent back to senders is not routed by the loopback. */
+int omt_receive_send(omt_receive_t *instance, OMTMediaFrame *frame)
+{
+    return 0;
+}
+
+void omt_receive_settally(omt_receive_t *instance, OMTTally *tally)
+{
+    LoopbackReceiver *r = (LoopbackReceiver *)instance;
+    LoopbackSender *s;
+
+    ff_mutex_lock(&lock);
+    r->tally = *tally;
+    if ((s = find_sender(r->address)))
+        loopback_update_tally(s);
+    ff_mutex_unlock(&lock);
+}
+
+int omt_receive_gettally(omt_send_t *instance, int timeoutMilliseconds, OMTTally *tally)
+{
+    LoopbackReceiver *r = (LoopbackReceiver *)instance;
+    LoopbackSender *s;
+
+    ff_mutex_lock(&lock);
+    *tally = (s = find_sender(r->address)) ? s->tally : r->tally;
+    ff_mutex_unlock(&lock);
+    return 0;
+}
+
+void omt_receive_setflags(omt_receive_t *instance, OMTReceiveFlags flags)
+{
+    LoopbackReceiver *r = (LoopbackReceiver *)instance;
+
+    ff_mutex_lock(&lock);
+    r->flags = flags;
+    ff_mutex_unlock(&lock);
+}
+
+void omt_receive_setsuggestedquality(omt_receive_t *instance, OMTQuality quality)
+{
+}
+
+void omt_receive_getsenderinformation(omt_receive_t *instance, OMTSenderInfo *info)
+{
+    LoopbackReceiver *r = (LoopbackReceiver *)instance;
+    LoopbackSender *s;
+
+    ff_mutex_lock(&lock);
+    if ((s = find_sender(r->address)))
+        *info = s->info;
+    else
+        memset(info, 0, sizeof(*info));
+    ff_mutex_unlock(&lock);
+}
+
+static void get_statistics(OMTStatistics *src, OMTStatistics *dst)
+{
+    ff_mutex_lock(&lock);
+    *dst = *src;
+    src->BytesSentSinceLast     = 0;
+    src->BytesReceivedSinceLast = 0;
+    src->FramesSinceLast        = 0;
+    ff_mutex_unlock(&lock);
+}
+
+void omt_receive_getvideostatistics(omt_receive_t *instance, OMTStatistics *stats)
+{
+    get_statistics(&((LoopbackReceiver *)instance)->stats[0], stats);
+}
+
+void omt_receive_getaudiostatistics(omt_receive_t *instance, OMTStatistics *stats)
+{
+    get_statistics(&((LoopbackReceiver *)instance)->stats[1], stats);
+}
+
+omt_send_t *omt_send_create(const char *name, OMTQuality quality)
+{
+    LoopbackSender *s = av_mallocz(sizeof(*s));
+
+    if (!s)
+        return NULL;
+    ff_thread_once(&cond_once, loopback_init_cond);
+    snprintf(s->address, sizeof(s->address), LOOPBACK_HOST " (%s)", name);
+
+    ff_mutex_lock(&lock);
+    if (find_sender(s->address)) {
+        ff_mutex_unlock(&lock);
+        av_free(s);
+        return NULL;
+    }
+    s->next = senders;
+    senders = s;
+    loopback_update_tally(s);
+    loopback_connect(s);
+    ff_mutex_unlock(&lock);
+
+    return (omt_send_t *)s;
+}
+
+void omt_send_setsenderinformation(omt_send_t *instance, OMTSenderInfo *info)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+
+    ff_mutex_lock(&lock);
+    s->info = *info;
+    ff_mutex_unlock(&lock);
+}
+
+void omt_send_addconnectionmetadata(omt_send_t *instance, const char *metadata)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+    char *m;
+
+    ff_mutex_lock(&lock);
+    m = av_asprintf("%s%s", s->connection_metadata ? s->connection_metadata : "", metadata);
+    if (m) {
+        av_free(s->connection_metadata);
+        s->connection_metadata = m;
+    }
+    for (LoopbackReceiver *r = receivers; r; r = r->next)
+        if (r->connected && !strcmp(r->address, s->address))
+            loopback_queue_metadata(r, metadata);
+    ff_mutex_unlock(&lock);
+}
+
+void omt_send_clearconnectionmetadata(omt_send_t *instance)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+
+    ff_mutex_lock(&lock);
+    av_freep(&s->connection_metadata);
+    ff_mutex_unlock(&lock);
+}
+
+void omt_send_setredirect(omt_send_t *instance, const char *newAddress)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+
+    ff_mutex_lock(&lock);
+    av_freep(&s->redirect);
+    if (newAddress && *newAddress)
+        s->redirect = av_strdup(newAddress);
+    ff_mutex_unlock(&lock);
+}
+
+int omt_send_getaddress(omt_send_t *instance, char *address, int maxLength)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+
+    av_strlcpy(address, s->address, maxLength);
+    return strlen(s->address) + 1;
+}
+
+void omt_send_destroy(omt_send_t *instance)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+
+    ff_mutex_lock(&lock);
+    for (LoopbackSender **p = &senders; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    for (LoopbackReceiver *r = receivers; r; r = r->next)
+        if (!strcmp(r->address, s->address))
+            r->connected = 0;
+    ff_mutex_unlock(&lock);
+
+    av_free(s->connection_metadata);
+    av_free(s->redirect);
+    av_free(s);
+}
+
+int omt_send(omt_send_t *instance, OMTMediaFrame *frame)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+    OMTMediaFrame f = *frame;
+    int idx = stats_index(f.Type);
+
+    if (f.Type == OMTFrameType_Video || f.Type == OMTFrameType_Audio) {
+        int64_t duration = f.Type == OMTFrameType_Video ?
+            (int64_t)10000000 * f.FrameRateD / FFMAX(f.FrameRateN, 1) :
+            (int64_t)10000000 * f.SamplesPerChannel / FFMAX(f.SampleRate, 1);
+
+        if (f.Timestamp == -1)
+            f.Timestamp = s->next_timestamp[idx];
+        s->next_timestamp[idx] = f.Timestamp + duration;
+    }
+
+    ff_mutex_lock(&lock);
+    for (LoopbackReceiver *r = receivers; r; r = r->next) {
+        if (strcmp(r->address, s->address) || !receiver_accepts(r, &f))
+            continue;
+        if (loopback_queue(r, &f) < 0)
+            r->stats[idx].FramesDropped++;
+    }
+    if (f.Type != OMTFrameType_Metadata) {
+        s->stats[idx].BytesSent          += f.DataLength;
+        s->stats[idx].BytesSentSinceLast += f.DataLength;
+        s->stats[idx].Frames++;
+        s->stats[idx].FramesSinceLast++;
+    }
+    ff_mutex_unlock(&lock);
+
+    return f.DataLength;
+}
+
+/* Receivers hold one connection for video and metadata and one for audio. */
+int omt_send_connections(omt_send_t *instance)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+    int n = 0;
+
+    ff_mutex_lock(&lock);
+    for (LoopbackReceiver *r = receivers; r; r = r->next)
+        if (!strcmp(r->address, s->address))
+            n += 2;
+    ff_mutex_unlock(&lock);
+    return n;
+}
+
+OMTMediaFrame *omt_send_receive(omt_send_t *instance, int timeoutMilliseconds)
+{
+    return NULL;
+}
+
+int omt_send_gettally(omt_send_t *instance, int timeoutMilliseconds, OMTTally *tally)
+{
+    LoopbackSender *s = (LoopbackSender *)instance;
+    int changed;
+
+    ff_mutex_lock(&lock);
+    changed = s->tally.program != s->reported_tally.program ||
+              s->tally.preview != s->reported_tally.preview;
+    *tally  = s->reported_tally = s->tally;
+    ff_mutex_unlock(&lock);
+    return changed;
+}
+
+void omt_send_getvideostatistics(omt_send_t *instance, OMTStatistics *stats)
+{
+    get_statistics(&((LoopbackSender *)instance)->stats[0], stats);
+}
+
+void omt_send_getaudiostatistics(omt_send_t *instance, OMTStatistics *stats)
+{
+    get_statistics(&((LoopbackSender *)instance)->stats[1], stats);
+}
+
+void omt_setloggingfilename(const char *filename)
+{
+}
+
+int omt_settings_get_string(const char *name, char *value, int maxLength)
+{
+    if (maxLength > 0)
+        *value = 0;
+    return 1;
+}
+
+void omt_settings_set_string(const char *name, const char *value)
+{
+}
+
+int omt_settings_get_integer(const char *name)
+{
+    return 0;
+}
+
+void omt_settings_set_integer(const char *name, int value)
+{
+}
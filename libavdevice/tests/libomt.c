@@ -0,0 +1,866 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Send frames through the libomt output device and receive them with the
+ * libomt input device over the loopback libomt, printing a checksum of
+ * every packet received, then check audio re-blocking, frame repetition,
+ * frame metadata and program routing of the output device the same way.
+ * With -b, measure the throughput of each format
+ * instead. With -r <dir>, measure recording 8 streams of 1080p60 VMX
+ * received with nativevmx=1 into MOV files in dir.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/channel_layout.h"
+#include "libavutil/dict.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
+#include "libavutil/timecode.h"
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavdevice/avdevice.h"
+
+typedef struct TestCase {
+    const char *name;
+    enum AVMediaType type;
+    int format;                 // pixel or sample format sent
+    enum AVCodecID codec_id;    // codec of the output stream, VMIX is passed through
+    int tenbit;                 // receive 16-bit video
+    int lossless;               // the packets received must match the frames sent
+} TestCase;
+
+static const TestCase tests[] = {
+    { "uyvy422",          AVMEDIA_TYPE_VIDEO, AV_PIX_FMT_UYVY422,     AV_CODEC_ID_WRAPPED_AVFRAME,  0, 1 },
+    { "bgra",             AVMEDIA_TYPE_VIDEO, AV_PIX_FMT_BGRA,        AV_CODEC_ID_WRAPPED_AVFRAME,  0, 1 },
+    { "yuv422p10le",      AVMEDIA_TYPE_VIDEO, AV_PIX_FMT_YUV422P10LE, AV_CODEC_ID_WRAPPED_AVFRAME,  1, 1 },
+    { "yuv422p10le-8bit", AVMEDIA_TYPE_VIDEO, AV_PIX_FMT_YUV422P10LE, AV_CODEC_ID_WRAPPED_AVFRAME,  0, 0 },
+    { "vmx",              AVMEDIA_TYPE_VIDEO, AV_PIX_FMT_YUV422P,     AV_CODEC_ID_VMIX,             0, 1 },
+    { "s16",              AVMEDIA_TYPE_AUDIO, AV_SAMPLE_FMT_S16,      AV_CODEC_ID_PCM_S16LE,        0, 0 },
+    { "s16p",             AVMEDIA_TYPE_AUDIO, AV_SAMPLE_FMT_S16P,     AV_CODEC_ID_PCM_S16LE_PLANAR, 0, 0 },
+    { "s32",              AVMEDIA_TYPE_AUDIO, AV_SAMPLE_FMT_S32,      AV_CODEC_ID_PCM_S32LE,        0, 0 },
+    { "flt",              AVMEDIA_TYPE_AUDIO, AV_SAMPLE_FMT_FLT,      AV_CODEC_ID_PCM_F32LE,        0, 0 },
+};
+
+typedef struct TestContext {
+    const TestCase *test;
+    int width, height;
+    int nb_samples;
+    AVRational frame_rate;
+    AVFormatContext *in, *out;
+    int header_written;
+    AVCodecContext *enc;
+    AVFrame *frame;
+    AVPacket *pkt;
+} TestContext;
+
+/* Fill the frame with a pattern that changes with n. */
+static void fill_video(AVFrame *frame, int n)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int depth = desc->comp[0].depth;
+
+    for (int p = 0; p < 4 && frame->data[p]; p++) {
+        int h = p && !(desc->flags & AV_PIX_FMT_FLAG_RGB) ?
+                AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+        int w = av_image_get_linesize(frame->format, frame->width, p);
+
+        for (int y = 0; y < h; y++) {
+            uint8_t *row = frame->data[p] + y * frame->linesize[p];
+
+            if (depth > 8) {
+                for (int x = 0; x < w / 2; x++)
+                    ((uint16_t *)row)[x] = (x * 3 + y * 5 + n * 7 + p * 11) & ((1 << depth) - 1);
+            } else {
+                for (int x = 0; x < w; x++)
+                    row[x] = x * 3 + y * 5 + n * 7 + p * 11;
+            }
+        }
+    }
+}
+
+static void fill_audio(uint8_t *data, enum AVSampleFormat format, int nb_samples, int n)
+{
+    int count = nb_samples * 2;
+
+    for (int i = 0; i < count; i++) {
+        int v = (i * 37 + n * 101) % 2048 - 1024;
+
+        switch (format) {
+        case AV_SAMPLE_FMT_S16:
+        case AV_SAMPLE_FMT_S16P: ((int16_t *)data)[i] = v * 16;      break;
+        case AV_SAMPLE_FMT_S32:  ((int32_t *)data)[i] = v * 1048576; break;
+        case AV_SAMPLE_FMT_FLT:  ((float   *)data)[i] = v / 1024.0f; break;
+        }
+    }
+}
+
+/*
+ * Build a VMX packet of the given size: a valid header with quality 90
+ * followed by a payload that changes with n. The receiver does not look
+ * further into it.
+ */
+static int make_vmx_packet(AVPacket *pkt, int size, int n)
+{
+    int ret = av_new_packet(pkt, size);
+    if (ret < 0)
+        return ret;
+
+    pkt->data[0] = 1;
+    pkt->data[1] = 90;
+    pkt->data[2] = 0;
+    for (int i = 3; i < size; i++)
+        pkt->data[i] = i * 3 + n * 7;
+    return 0;
+}
+
+static void print_packet(const AVPacket *pkt)
+{
+    printf("%d, %10"PRId64", %10"PRId64", %8d, 0x%08"PRIx32"\n", pkt->stream_index,
+           pkt->pts, pkt->duration, pkt->size, av_adler32_update(0, pkt->data, pkt->size));
+}
+
+static int open_test(TestContext *t, const TestCase *test, const char *name,
+                     int width, int height, AVRational frame_rate, int nb_samples)
+{
+    const AVOutputFormat *ofmt = av_guess_format("libomt", NULL, NULL);
+    const AVInputFormat *ifmt = av_find_input_format("libomt");
+    AVDictionary *opts = NULL;
+    char address[128];
+    AVStream *st;
+    int ret;
+
+    memset(t, 0, sizeof(*t));
+    t->test       = test;
+    t->width      = width;
+    t->height     = height;
+    t->frame_rate = frame_rate;
+    t->nb_samples = nb_samples;
+
+    if (!ofmt || !ifmt) {
+        fprintf(stderr, "libomt devices not available\n");
+        return AVERROR_DEMUXER_NOT_FOUND;
+    }
+
+    snprintf(address, sizeof(address), "LOOPBACK (%s)", name);
+
+    /* The receiver is created first so it gets every frame sent. */
+    av_dict_set(&opts, "tenbit", test->tenbit ? "1" : "0", 0);
+    if (test->codec_id == AV_CODEC_ID_VMIX)
+        av_dict_set(&opts, "nativevmx", "1", 0);
+    ret = avformat_open_input(&t->in, address, ifmt, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+
+    if ((ret = avformat_alloc_output_context2(&t->out, ofmt, NULL, name)) < 0)
+        return ret;
+    if (!(st = avformat_new_stream(t->out, NULL)))
+        return AVERROR(ENOMEM);
+
+    st->codecpar->codec_type = test->type;
+    st->codecpar->codec_id   = test->codec_id;
+    st->codecpar->format     = test->format;
+    if (test->codec_id == AV_CODEC_ID_VMIX) {
+        st->codecpar->width  = width;
+        st->codecpar->height = height;
+        st->codecpar->bits_per_raw_sample = 8;
+        st->time_base        = av_inv_q(frame_rate);
+        st->avg_frame_rate   = frame_rate;
+    } else if (test->type == AVMEDIA_TYPE_VIDEO) {
+        const AVCodec *codec = avcodec_find_encoder(test->codec_id);
+
+        st->codecpar->width  = width;
+        st->codecpar->height = height;
+        st->time_base        = av_inv_q(frame_rate);
+        st->avg_frame_rate   = frame_rate;
+
+        if (!codec || !(t->enc = avcodec_alloc_context3(codec)))
+            return AVERROR_ENCODER_NOT_FOUND;
+        t->enc->width     = width;
+        t->enc->height    = height;
+        t->enc->pix_fmt   = test->format;
+        t->enc->time_base = st->time_base;
+        if ((ret = avcodec_open2(t->enc, codec, NULL)) < 0)
+            return ret;
+    } else {
+        st->codecpar->sample_rate = 48000;
+        av_channel_layout_default(&st->codecpar->ch_layout, 2);
+        st->time_base = (AVRational){ 1, 48000 };
+    }
+
+    if ((ret = avformat_write_header(t->out, NULL)) < 0)
+        return ret;
+    t->header_written = 1;
+
+    if (!(t->frame = av_frame_alloc()) || !(t->pkt = av_packet_alloc()))
+        return AVERROR(ENOMEM);
+    if (test->type == AVMEDIA_TYPE_VIDEO && t->enc) {
+        t->frame->format = test->format;
+        t->frame->width  = width;
+        t->frame->height = height;
+        if ((ret = av_frame_get_buffer(t->frame, 0)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static void close_test(TestContext *t)
+{
+    if (t->header_written)
+        av_write_trailer(t->out);
+    avformat_free_context(t->out);
+    avformat_close_input(&t->in);
+    avcodec_free_context(&t->enc);
+    av_frame_free(&t->frame);
+    av_packet_free(&t->pkt);
+}
+
+/* Send frame n, built from the current content of t->frame for video. */
+static int send_frame(TestContext *t, int n)
+{
+    const TestCase *test = t->test;
+    AVRational time_base = { 1, 48000 };
+    int ret;
+
+    if (test->codec_id == AV_CODEC_ID_VMIX) {
+        /* about 300 Mbit/s at 1080p60, as sent by vMix */
+        if ((ret = make_vmx_packet(t->pkt, t->width * t->height / 3, n)) < 0)
+            return ret;
+        t->pkt->pts = t->pkt->dts = n;
+        t->pkt->duration = 1;
+        t->pkt->flags   |= AV_PKT_FLAG_KEY;
+        time_base = av_inv_q(t->frame_rate);
+    } else if (test->type == AVMEDIA_TYPE_VIDEO) {
+        t->frame->pts = n;
+        if ((ret = avcodec_send_frame(t->enc, t->frame)) < 0 ||
+            (ret = avcodec_receive_packet(t->enc, t->pkt)) < 0)
+            return ret;
+        time_base = t->enc->time_base;
+    } else {
+        int size = av_samples_get_buffer_size(NULL, 2, t->nb_samples, test->format, 1);
+
+        if ((ret = av_new_packet(t->pkt, size)) < 0)
+            return ret;
+        fill_audio(t->pkt->data, test->format, t->nb_samples, n);
+        t->pkt->pts = t->pkt->dts = (int64_t)n * t->nb_samples;
+        t->pkt->duration = t->nb_samples;
+    }
+    av_packet_rescale_ts(t->pkt, time_base, t->out->streams[0]->time_base);
+    t->pkt->stream_index = 0;
+
+    ret = av_write_frame(t->out, t->pkt);
+    av_packet_unref(t->pkt);
+    return ret;
+}
+
+static int receive_packet(AVFormatContext *in, AVPacket *pkt)
+{
+    for (int tries = 0; tries < 50; tries++) {
+        int ret = av_read_frame(in, pkt);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+    }
+    return AVERROR(ETIMEDOUT);
+}
+
+static int run_test(const TestCase *test)
+{
+    TestContext t;
+    AVPacket *pkt = av_packet_alloc();
+    uint8_t *expected = NULL;
+    char name[64];
+    int ret, nb_frames = 3;
+
+    if (!pkt)
+        return AVERROR(ENOMEM);
+    snprintf(name, sizeof(name), "fate-%s", test->name);
+    if ((ret = open_test(&t, test, name, 360, 240, (AVRational){ 25, 1 }, 1024)) < 0)
+        goto end;
+
+    for (int n = 0; n < nb_frames; n++) {
+        if (t.enc) {
+            if ((ret = av_frame_make_writable(t.frame)) < 0)
+                goto end;
+            fill_video(t.frame, n);
+        }
+        if ((ret = send_frame(&t, n)) < 0)
+            goto end;
+    }
+
+    for (int n = 0; n < nb_frames; n++) {
+        AVCodecParameters *par;
+
+        if ((ret = receive_packet(t.in, pkt)) < 0)
+            goto end;
+        par = t.in->streams[pkt->stream_index]->codecpar;
+
+        if (!n) {
+            if (par->codec_type == AVMEDIA_TYPE_VIDEO)
+                printf("%s: %s %s %dx%d\n", test->name, avcodec_get_name(par->codec_id),
+                       av_get_pix_fmt_name(par->format), par->width, par->height);
+            else
+                printf("%s: %s %d Hz %d channels\n", test->name, avcodec_get_name(par->codec_id),
+                       par->sample_rate, par->ch_layout.nb_channels);
+        }
+        print_packet(pkt);
+
+        if (test->codec_id == AV_CODEC_ID_VMIX) {
+            const AVDictionaryEntry *e = av_dict_get(t.in->streams[pkt->stream_index]->metadata,
+                                                     "vmx_quality", NULL, 0);
+            if (!e || strcmp(e->value, "90")) {
+                fprintf(stderr, "%s: frame %d does not export the quality level\n", test->name, n);
+                ret = AVERROR_BUG;
+                goto end;
+            }
+            if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+                fprintf(stderr, "%s: frame %d has no keyframe flag\n", test->name, n);
+                ret = AVERROR_BUG;
+                goto end;
+            }
+            if ((ret = make_vmx_packet(t.pkt, t.width * t.height / 3, n)) < 0)
+                goto end;
+            ret = pkt->size != t.pkt->size || memcmp(pkt->data, t.pkt->data, pkt->size);
+            av_packet_unref(t.pkt);
+            if (ret) {
+                fprintf(stderr, "%s: frame %d differs from the frame sent\n", test->name, n);
+                ret = AVERROR_BUG;
+                goto end;
+            }
+        } else if (test->lossless) {
+            int size = av_image_get_buffer_size(test->format, t.width, t.height, 1);
+
+            if (!expected && !(expected = av_malloc(size))) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            if ((ret = av_frame_make_writable(t.frame)) < 0)
+                goto end;
+            fill_video(t.frame, n);
+            av_image_copy_to_buffer(expected, size, (const uint8_t * const *)t.frame->data,
+                                    t.frame->linesize, test->format, t.width, t.height, 1);
+            if (pkt->size != size || memcmp(pkt->data, expected, size)) {
+                fprintf(stderr, "%s: frame %d differs from the frame sent\n", test->name, n);
+                ret = AVERROR_BUG;
+                goto end;
+            }
+        }
+        av_packet_unref(pkt);
+    }
+
+end:
+    if (ret < 0)
+        fprintf(stderr, "%s: %s\n", test->name, av_err2str(ret));
+    close_test(&t);
+    av_packet_free(&pkt);
+    av_free(expected);
+    return ret;
+}
+
+/*
+ * The muxer feature tests below send 64x16 uyvy422 frames as uncoded
+ * frames and s16 stereo audio as packets, with the options under test.
+ */
+static int open_receiver(AVFormatContext **in, const char *name)
+{
+    char address[128];
+
+    snprintf(address, sizeof(address), "LOOPBACK (%s)", name);
+    return avformat_open_input(in, address, av_find_input_format("libomt"), NULL);
+}
+
+static AVStream *add_stream(AVFormatContext *out, enum AVMediaType type, AVRational frame_rate)
+{
+    AVStream *st = avformat_new_stream(out, NULL);
+
+    if (!st)
+        return NULL;
+    st->codecpar->codec_type = type;
+    if (type == AVMEDIA_TYPE_VIDEO) {
+        st->codecpar->codec_id = AV_CODEC_ID_WRAPPED_AVFRAME;
+        st->codecpar->format   = AV_PIX_FMT_UYVY422;
+        st->codecpar->width    = 64;
+        st->codecpar->height   = 16;
+        st->time_base          = av_inv_q(frame_rate);
+        st->avg_frame_rate     = frame_rate;
+    } else {
+        st->codecpar->codec_id    = AV_CODEC_ID_PCM_S16LE;
+        st->codecpar->format      = AV_SAMPLE_FMT_S16;
+        st->codecpar->sample_rate = 48000;
+        av_channel_layout_default(&st->codecpar->ch_layout, 2);
+        st->time_base = (AVRational){ 1, 48000 };
+    }
+    return st;
+}
+
+/* Send video frame n; tc is the S12M timecode to attach, if not 0. */
+static int write_video_frame(AVFormatContext *out, int stream_index, int n, uint32_t tc)
+{
+    const AVStream *st = out->streams[stream_index];
+    AVRational duration = av_inv_q(st->avg_frame_rate);
+    AVFrame *frame = av_frame_alloc();
+    int ret;
+
+    if (!frame)
+        return AVERROR(ENOMEM);
+    frame->format = st->codecpar->format;
+    frame->width  = st->codecpar->width;
+    frame->height = st->codecpar->height;
+    if ((ret = av_frame_get_buffer(frame, 0)) < 0)
+        goto fail;
+    fill_video(frame, n + stream_index * 13);
+    frame->pts      = av_rescale_q(n, duration, st->time_base);
+    frame->duration = av_rescale_q(1, duration, st->time_base);
+    frame->color_primaries = st->codecpar->color_primaries;
+    frame->color_trc       = st->codecpar->color_trc;
+    frame->colorspace      = st->codecpar->color_space;
+    frame->color_range     = st->codecpar->color_range;
+
+    if (tc) {
+        AVFrameSideData *sd = av_frame_new_side_data(frame, AV_FRAME_DATA_S12M_TIMECODE,
+                                                     4 * sizeof(uint32_t));
+        if (!sd) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        ((uint32_t *)sd->data)[0] = 1;
+        ((uint32_t *)sd->data)[1] = tc;
+    }
+
+    return av_write_uncoded_frame(out, stream_index, frame);
+fail:
+    av_frame_free(&frame);
+    return ret;
+}
+
+/* Send nb_samples of audio starting at sample pts. */
+static int write_audio_packet(AVFormatContext *out, AVPacket *pkt, int stream_index,
+                              int64_t pts, int nb_samples)
+{
+    const AVStream *st = out->streams[stream_index];
+    AVRational time_base = { 1, 48000 };
+    int ret;
+
+    if ((ret = av_new_packet(pkt, nb_samples * 4)) < 0)
+        return ret;
+    fill_audio(pkt->data, AV_SAMPLE_FMT_S16, nb_samples, pts / 1024);
+    pkt->pts          = pkt->dts = av_rescale_q(pts, time_base, st->time_base);
+    pkt->duration     = av_rescale_q(nb_samples, time_base, st->time_base);
+    pkt->stream_index = stream_index;
+
+    ret = av_write_frame(out, pkt);
+    av_packet_unref(pkt);
+    return ret;
+}
+
+/* Receive and print nb_packets packets. */
+static int print_packets(const char *name, AVFormatContext *in, AVPacket *pkt, int nb_packets)
+{
+    printf("%s:\n", name);
+    for (int n = 0; n < nb_packets; n++) {
+        int ret = receive_packet(in, pkt);
+
+        if (ret < 0)
+            return ret;
+        print_packet(pkt);
+        av_packet_unref(pkt);
+    }
+    return 0;
+}
+
+/*
+ * Re-block 8 packets of 1024 samples into one audio frame per video frame
+ * at 30000/1001, 1602/1601/1602/1601/1602 samples, and the remaining 184
+ * samples when the output is closed.
+ */
+static int test_audio_blocks(AVPacket *pkt)
+{
+    static const char name[] = "fate-audio-blocks";
+    AVFormatContext *in = NULL, *out = NULL;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if ((ret = open_receiver(&in, name)) < 0 ||
+        (ret = avformat_alloc_output_context2(&out, NULL, "libomt", name)) < 0)
+        goto end;
+    if (!add_stream(out, AVMEDIA_TYPE_VIDEO, (AVRational){ 30000, 1001 }) ||
+        !add_stream(out, AVMEDIA_TYPE_AUDIO, (AVRational){ 0 })) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    av_dict_set(&opts, "audio_frame_size", "video", 0);
+    if ((ret = avformat_write_header(out, &opts)) < 0)
+        goto end;
+
+    for (int n = 0; n < 5; n++)
+        if ((ret = write_video_frame(out, 0, n, 0)) < 0)
+            goto end;
+    for (int n = 0; n < 8; n++)
+        if ((ret = write_audio_packet(out, pkt, 1, n * 1024, 1024)) < 0)
+            goto end;
+    if ((ret = av_write_trailer(out)) < 0)
+        goto end;
+
+    ret = print_packets("audio-blocks", in, pkt, 11);
+
+end:
+    av_dict_free(&opts);
+    avformat_free_context(out);
+    avformat_close_input(&in);
+    return ret;
+}
+
+/*
+ * With the send thread, the last video frame is repeated every frame
+ * period once none arrived for repeat_timeout, along with a frame of
+ * silence, both continuing the timestamps of the last frames.
+ */
+static int test_repeat(AVPacket *pkt)
+{
+    static const char name[] = "fate-repeat";
+    AVFormatContext *in = NULL, *out = NULL;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    if ((ret = open_receiver(&in, name)) < 0 ||
+        (ret = avformat_alloc_output_context2(&out, NULL, "libomt", name)) < 0)
+        goto end;
+    if (!add_stream(out, AVMEDIA_TYPE_VIDEO, (AVRational){ 25, 1 }) ||
+        !add_stream(out, AVMEDIA_TYPE_AUDIO, (AVRational){ 0 })) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    av_dict_set(&opts, "send_thread", "1", 0);
+    av_dict_set(&opts, "repeat_timeout", "0.02", 0);
+    if ((ret = avformat_write_header(out, &opts)) < 0)
+        goto end;
+
+    /* audio first, so that the repeats cannot overtake it */
+    if ((ret = write_audio_packet(out, pkt, 1, 0, 1920)) < 0 ||
+        (ret = write_video_frame(out, 0, 0, 0)) < 0)
+        goto end;
+
+    ret = print_packets("repeat", in, pkt, 8);
+    if (ret >= 0)
+        ret = av_write_trailer(out);
+
+end:
+    av_dict_free(&opts);
+    avformat_free_context(out);
+    avformat_close_input(&in);
+    return ret;
+}
+
+/*
+ * Round-trip the timecode, counted from the start timecode of the stream
+ * or taken from the S12M side data of a frame, and the colour properties
+ * OMT cannot signal through frame_metadata.
+ */
+static int test_frame_metadata(AVPacket *pkt)
+{
+    static const char name[] = "fate-frame-metadata";
+    AVRational rate = { 25, 1 };
+    AVFormatContext *in = NULL, *out = NULL;
+    AVDictionary *opts = NULL;
+    const AVDictionaryEntry *e;
+    const AVCodecParameters *par;
+    AVStream *st;
+    int ret;
+
+    if ((ret = open_receiver(&in, name)) < 0 ||
+        (ret = avformat_alloc_output_context2(&out, NULL, "libomt", name)) < 0)
+        goto end;
+    if (!(st = add_stream(out, AVMEDIA_TYPE_VIDEO, rate))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    st->codecpar->color_primaries = AVCOL_PRI_BT2020;
+    st->codecpar->color_trc       = AVCOL_TRC_SMPTE2084;
+    st->codecpar->color_space     = AVCOL_SPC_BT2020_NCL;
+    st->codecpar->color_range     = AVCOL_RANGE_MPEG;
+    av_dict_set(&st->metadata, "timecode", "10:00:00:00", 0);
+    av_dict_set(&opts, "frame_metadata", "timecode+hdr", 0);
+    if ((ret = avformat_write_header(out, &opts)) < 0)
+        goto end;
+
+    for (int n = 0; n < 3; n++) {
+        uint32_t tc = n == 2 ? av_timecode_get_smpte(rate, 0, 11, 0, 0, 0) : 0;
+        if ((ret = write_video_frame(out, 0, n, tc)) < 0)
+            goto end;
+    }
+
+    printf("frame-metadata:\n");
+    for (int n = 0; n < 3; n++) {
+        char tcbuf[AV_TIMECODE_STR_SIZE] = "none";
+        const uint32_t *sd;
+
+        if ((ret = receive_packet(in, pkt)) < 0)
+            goto end;
+        if ((sd = (const uint32_t *)av_packet_get_side_data(pkt, AV_PKT_DATA_S12M_TIMECODE, NULL)))
+            av_timecode_make_smpte_tc_string2(tcbuf, rate, sd[1], 0, 0);
+        printf("%"PRId64" timecode %s\n", pkt->pts, tcbuf);
+        av_packet_unref(pkt);
+    }
+
+    e   = av_dict_get(in->streams[0]->metadata, "timecode", NULL, 0);
+    par = in->streams[0]->codecpar;
+    printf("stream timecode %s, colour %s/%s/%s %s\n", e ? e->value : "none",
+           av_color_space_name(par->color_space), av_color_primaries_name(par->color_primaries),
+           av_color_transfer_name(par->color_trc), av_color_range_name(par->color_range));
+    ret = av_write_trailer(out);
+
+end:
+    av_dict_free(&opts);
+    avformat_free_context(out);
+    avformat_close_input(&in);
+    return ret;
+}
+
+/*
+ * Each output program gets a sender named after its title: the first
+ * receives video and audio, the second only its own video.
+ */
+static int test_programs(AVPacket *pkt)
+{
+    static const char *const names[2] = { "fate-program-a", "fate-program-b" };
+    AVFormatContext *in[2] = { NULL }, *out = NULL;
+    int ret;
+
+    for (int p = 0; p < 2; p++)
+        if ((ret = open_receiver(&in[p], names[p])) < 0)
+            goto end;
+    if ((ret = avformat_alloc_output_context2(&out, NULL, "libomt", "fate-programs")) < 0)
+        goto end;
+    if (!add_stream(out, AVMEDIA_TYPE_VIDEO, (AVRational){ 25, 1 }) ||
+        !add_stream(out, AVMEDIA_TYPE_VIDEO, (AVRational){ 25, 1 }) ||
+        !add_stream(out, AVMEDIA_TYPE_AUDIO, (AVRational){ 0 })) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (int p = 0; p < 2; p++) {
+        AVProgram *program = av_new_program(out, p + 1);
+
+        if (!program) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        av_dict_set(&program->metadata, "title", names[p], 0);
+        av_program_add_stream_index(out, p + 1, p);
+    }
+    av_program_add_stream_index(out, 1, 2);
+    if ((ret = avformat_write_header(out, NULL)) < 0)
+        goto end;
+
+    for (int n = 0; n < 2; n++) {
+        if ((ret = write_video_frame(out, 0, n, 0)) < 0 ||
+            (ret = write_video_frame(out, 1, n, 0)) < 0 ||
+            (ret = write_audio_packet(out, pkt, 2, n * 1920, 1920)) < 0)
+            goto end;
+    }
+
+    if ((ret = print_packets("program-a", in[0], pkt, 4)) < 0 ||
+        (ret = print_packets("program-b", in[1], pkt, 2)) < 0)
+        goto end;
+    for (int p = 0; p < 2; p++) {
+        if (av_read_frame(in[p], pkt) != AVERROR(EAGAIN)) {
+            fprintf(stderr, "%s: received a frame of another program\n", names[p]);
+            ret = AVERROR_BUG;
+            goto end;
+        }
+    }
+    ret = av_write_trailer(out);
+
+end:
+    avformat_free_context(out);
+    for (int p = 0; p < 2; p++)
+        avformat_close_input(&in[p]);
+    return ret;
+}
+
+static int run_feature_tests(void)
+{
+    static int (*const tests[])(AVPacket *) = {
+        test_audio_blocks, test_repeat, test_frame_metadata, test_programs,
+    };
+    AVPacket *pkt = av_packet_alloc();
+    int ret = 0;
+
+    if (!pkt)
+        return AVERROR(ENOMEM);
+    for (int i = 0; i < FF_ARRAY_ELEMS(tests); i++) {
+        int err = tests[i](pkt);
+        if (err < 0) {
+            fprintf(stderr, "feature test %d: %s\n", i, av_err2str(err));
+            ret = err;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    return ret;
+}
+
+/* Send and receive 1080p video or 40 ms audio frames for about a second. */
+static int run_benchmark(const TestCase *test)
+{
+    TestContext t;
+    AVPacket *pkt = av_packet_alloc();
+    int64_t start, elapsed;
+    int ret, n;
+
+    if (!pkt)
+        return AVERROR(ENOMEM);
+    if ((ret = open_test(&t, test, test->name, 1920, 1080, (AVRational){ 25, 1 }, 1920)) < 0)
+        goto end;
+    if (t.enc)
+        fill_video(t.frame, 0);
+
+    start = av_gettime_relative();
+    for (n = 0; (elapsed = av_gettime_relative() - start) < 1000000; n++) {
+        if ((ret = send_frame(&t, n)) < 0 ||
+            (ret = receive_packet(t.in, pkt)) < 0)
+            goto end;
+        av_packet_unref(pkt);
+    }
+
+    printf("%-18s %10.1f frames/s %12"PRId64" ns/frame\n", test->name,
+           n * 1e6 / elapsed, elapsed * 1000 / FFMAX(n, 1));
+
+end:
+    if (ret < 0)
+        fprintf(stderr, "%s: %s\n", test->name, av_err2str(ret));
+    close_test(&t);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+#define RECORD_STREAMS 8
+#define RECORD_FRAMES  240
+
+/*
+ * Receive RECORD_STREAMS streams of 1080p60 VMX with nativevmx=1 and
+ * stream copy each into a MOV file, as a recorder would. Every stream
+ * needs 60 frames/s to be recorded in real time.
+ */
+static int run_record_benchmark(const char *dir)
+{
+    static const TestCase vmx = { "vmx", AVMEDIA_TYPE_VIDEO, AV_PIX_FMT_YUV422P, AV_CODEC_ID_VMIX };
+    TestContext t[RECORD_STREAMS] = { 0 };
+    AVFormatContext *mov[RECORD_STREAMS] = { NULL };
+    char filename[RECORD_STREAMS][1024];
+    AVPacket *pkt = av_packet_alloc();
+    int64_t start, elapsed, bytes = 0;
+    int ret = 0;
+
+    if (!pkt)
+        return AVERROR(ENOMEM);
+
+    for (int s = 0; s < RECORD_STREAMS; s++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "record-%d", s);
+        snprintf(filename[s], sizeof(filename[s]), "%s/libomt-%s.mov", dir, name);
+        if ((ret = open_test(&t[s], &vmx, name, 1920, 1080, (AVRational){ 60, 1 }, 0)) < 0)
+            goto end;
+    }
+
+    start = av_gettime_relative();
+    for (int n = 0; n < RECORD_FRAMES; n++) {
+        for (int s = 0; s < RECORD_STREAMS; s++) {
+            AVStream *ist, *ost;
+
+            if ((ret = send_frame(&t[s], n)) < 0 ||
+                (ret = receive_packet(t[s].in, pkt)) < 0)
+                goto end;
+            ist = t[s].in->streams[pkt->stream_index];
+
+            /* the stream only exists once the first frame is received */
+            if (!mov[s]) {
+                if ((ret = avformat_alloc_output_context2(&mov[s], NULL, "mov", filename[s])) < 0)
+                    goto end;
+                if (!(ost = avformat_new_stream(mov[s], NULL))) {
+                    ret = AVERROR(ENOMEM);
+                    goto end;
+                }
+                if ((ret = avcodec_parameters_copy(ost->codecpar, ist->codecpar)) < 0)
+                    goto end;
+                ost->time_base = av_inv_q(ist->avg_frame_rate);
+                if ((ret = avio_open(&mov[s]->pb, filename[s], AVIO_FLAG_WRITE)) < 0 ||
+                    (ret = avformat_write_header(mov[s], NULL)) < 0)
+                    goto end;
+            }
+            ost = mov[s]->streams[0];
+
+            bytes += pkt->size;
+            av_packet_rescale_ts(pkt, ist->time_base, ost->time_base);
+            pkt->stream_index = 0;
+            if ((ret = av_write_frame(mov[s], pkt)) < 0)
+                goto end;
+            av_packet_unref(pkt);
+        }
+    }
+    for (int s = 0; s < RECORD_STREAMS; s++)
+        if ((ret = av_write_trailer(mov[s])) < 0)
+            goto end;
+    elapsed = av_gettime_relative() - start;
+
+    printf("%d x 1080p60 vmx: %.1f frames/s per stream, %.2fx real time, %.1f MB/s\n",
+           RECORD_STREAMS, RECORD_FRAMES * 1e6 / elapsed,
+           RECORD_FRAMES * 1e6 / elapsed / 60, bytes / (double)elapsed);
+
+end:
+    if (ret < 0)
+        fprintf(stderr, "record: %s\n", av_err2str(ret));
+    for (int s = 0; s < RECORD_STREAMS; s++) {
+        if (mov[s]) {
+            avio_closep(&mov[s]->pb);
+            avformat_free_context(mov[s]);
+            unlink(filename[s]);
+        }
+        close_test(&t[s]);
+    }
+    av_packet_free(&pkt);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int bench = argc > 1 && !strcmp(argv[1], "-b");
+    int ret = 0;
+
+    av_log_set_level(AV_LOG_ERROR);
+    avdevice_register_all();
+
+    if (argc > 2 && !strcmp(argv[1], "-r"))
+        return run_record_benchmark(argv[2]) < 0;
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(tests); i++) {
+        if ((bench ? run_benchmark(&tests[i]) : run_test(&tests[i])) < 0)
+            ret = 1;
+    }
+    if (!bench && run_feature_tests() < 0)
+        ret = 1;
+    return ret;
+}
@@ -301,6 +301,8 @@ const AVCodecTag ff_codec_movvideo_tags[] = {
 
     { AV_CODEC_ID_APV, MKTAG('a', 'p', 'v', '1') },
 
+    { AV_CODEC_ID_VMIX, MKTAG('V', 'M', 'X', '1') },
+
     { AV_CODEC_ID_NONE, 0 },
 };
 
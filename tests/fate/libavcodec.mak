@@ -91,6 +91,11 @@ fate-rangecoder: libavcodec/tests/rangecoder$(EXESUF)
 fate-rangecoder: CMD = run libavcodec/tests/rangecoder$(EXESUF)
 fate-rangecoder: CMP = null
 
+FATE_LIBAVCODEC-$(CONFIG_VMIX_DECODER) += fate-vmix-decode
+fate-vmix-decode: libavcodec/tests/vmix$(EXESUF)
+fate-vmix-decode: CMD = run libavcodec/tests/vmix$(EXESUF)
+fate-vmix-decode: CMP = null
+
 FATE_LIBAVCODEC-yes += fate-mathops
 fate-mathops: libavcodec/tests/mathops$(EXESUF)
 fate-mathops: CMD = run libavcodec/tests/mathops$(EXESUF)
@@ -2,5 +2,9 @@ FATE_LIBAVDEVICE-$(CONFIG_JACK_INDEV) += fate-timefilter
 fate-timefilter: libavdevice/tests/timefilter$(EXESUF)
 fate-timefilter: CMD = run libavdevice/tests/timefilter
 
+FATE_LIBAVDEVICE-$(call ALLYES, LIBOMT_LOOPBACK LIBOMT_INDEV LIBOMT_OUTDEV WRAPPED_AVFRAME_ENCODER) += fate-libomt-loopback
+fate-libomt-loopback: libavdevice/tests/libomt$(EXESUF)
+fate-libomt-loopback: CMD = run libavdevice/tests/libomt
+
 FATE-$(CONFIG_AVDEVICE) += $(FATE_LIBAVDEVICE-yes)
 fate-libavdevice: $(FATE_LIBAVDEVICE-yes)
@@ -479,6 +479,12 @@ fate-vsynth%-avui:               ENCOPTS = -s pal -strict experimental -sws_flag
 fate-vsynth%-avui:               DECOPTS = -sws_flags neighbor+bitexact $(DEFAULT_SIZE)
 fate-vsynth%-avui:               FMT     = mov
 
+FATE_VCODEC_SCALE-$(call ENCDEC, VMIX, AVI) += vmix vmix-q36 vmix-yuva422p
+fate-vsynth%-vmix:               ENCOPTS = -pix_fmt yuv422p -dct int \
+                                           -threads 3 -thread_type slice
+fate-vsynth%-vmix-q36:           ENCOPTS = -pix_fmt yuv422p -dct int -quality 36
+fate-vsynth%-vmix-yuva422p:      ENCOPTS = -pix_fmt yuva422p -dct int -quality 99
+
 FATE_VCODEC-$(call ENCDEC, WMV1, AVI)   += wmv1
 fate-vsynth%-wmv1:               ENCOPTS = -qscale 10
 
@@ -504,7 +510,10 @@ FATE_VCODEC += $(FATE_VCODEC-yes)
 FATE_VCODEC := $(if $(call ENCDEC, RAWVIDEO, RAWVIDEO),$(FATE_VCODEC))
 FATE_VSYNTH1 = $(FATE_VCODEC:%=fate-vsynth1-%)
 FATE_VSYNTH2 = $(FATE_VCODEC:%=fate-vsynth2-%)
-FATE_VSYNTH_LENA = $(FATE_VCODEC:%=fate-vsynth_lena-%)
+# No references for the lena sample
+LENA_OFF     = vmix vmix-q36 vmix-yuva422p
+FATE_VCODEC_LENA = $(filter-out $(LENA_OFF),$(FATE_VCODEC))
+FATE_VSYNTH_LENA = $(FATE_VCODEC_LENA:%=fate-vsynth_lena-%)
 # Redundant tests because they just resize the input
 RESIZE_OFF   = dnxhd-720p dnxhd-720p-rd dnxhd-720p-10bit dnxhd-1080i \
                dv dv-411 dv-50 avui snow snow-hpel snow-ll vc2-420p \
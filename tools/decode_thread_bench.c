@@ -0,0 +1,197 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Measure how video decoding scales with the number of threads.
+ *
+ * The packets of the first video stream are read into memory once and
+ * then decoded with 1 to max_threads threads. For every thread count the
+ * frame rate and the scaling efficiency, the speedup over one thread
+ * divided by the number of threads, are printed.
+ *
+ * A synthetic vMix stream to run this on can be created with
+ *   ffmpeg -f lavfi -i testsrc2=s=1920x1080:r=60 -frames:v 240 -c:v vmix vmix.mov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+
+#include "libavformat/avformat.h"
+
+#include "libavcodec/avcodec.h"
+
+static int decode_packets(const AVCodecParameters *par, AVPacket **pkts,
+                          int nb_pkts, int threads, int thread_type,
+                          int *nb_frames)
+{
+    const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+    AVCodecContext *avctx = NULL;
+    AVFrame *frame = NULL;
+    int ret;
+
+    *nb_frames = 0;
+
+    avctx = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    if (!avctx || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    ret = avcodec_parameters_to_context(avctx, par);
+    if (ret < 0)
+        goto fail;
+
+    avctx->thread_count = threads;
+    avctx->thread_type  = thread_type;
+
+    ret = avcodec_open2(avctx, codec, NULL);
+    if (ret < 0)
+        goto fail;
+
+    for (int i = 0; i <= nb_pkts; i++) {
+        ret = avcodec_send_packet(avctx, i < nb_pkts ? pkts[i] : NULL);
+        if (ret < 0)
+            goto fail;
+
+        while ((ret = avcodec_receive_frame(avctx, frame)) >= 0) {
+            (*nb_frames)++;
+            av_frame_unref(frame);
+        }
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret != AVERROR(EAGAIN))
+            goto fail;
+    }
+    ret = 0;
+
+fail:
+    av_frame_free(&frame);
+    avcodec_free_context(&avctx);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVPacket **pkts = NULL;
+    int nb_pkts = 0, max_pkts, max_threads, thread_type, stream_idx;
+    double fps1 = 0.0;
+    int ret;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input file> [max threads] [max frames] "
+                "[frame|slice]\n", argv[0]);
+        return 1;
+    }
+
+    max_threads = argc > 2 ? atoi(argv[2]) : 4;
+    max_pkts    = argc > 3 ? atoi(argv[3]) : 300;
+    thread_type = argc > 4 && !strcmp(argv[4], "frame") ? FF_THREAD_FRAME :
+                                                           FF_THREAD_SLICE;
+    if (max_threads < 1 || max_pkts < 1) {
+        fprintf(stderr, "Invalid thread or frame count\n");
+        return 1;
+    }
+
+    ret = avformat_open_input(&fmt_ctx, argv[1], NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Error opening input file: %s\n", av_err2str(ret));
+        return 1;
+    }
+
+    ret = avformat_find_stream_info(fmt_ctx, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Error finding stream info: %s\n", av_err2str(ret));
+        goto end;
+    }
+
+    ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (ret < 0) {
+        fprintf(stderr, "No decodable video stream: %s\n", av_err2str(ret));
+        goto end;
+    }
+    stream_idx = ret;
+
+    pkts = av_calloc(max_pkts, sizeof(*pkts));
+    if (!pkts) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* keep all packets in memory so that only decoding is measured */
+    while (nb_pkts < max_pkts) {
+        AVPacket *pkt = av_packet_alloc();
+        if (!pkt) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        ret = av_read_frame(fmt_ctx, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
+        if (pkt->stream_index != stream_idx) {
+            av_packet_free(&pkt);
+            continue;
+        }
+        pkts[nb_pkts++] = pkt;
+    }
+    if (ret < 0 && ret != AVERROR_EOF) {
+        fprintf(stderr, "Error reading input: %s\n", av_err2str(ret));
+        goto end;
+    }
+
+    printf("%s: %d packets, %s threading\n", argv[1], nb_pkts,
+           thread_type == FF_THREAD_FRAME ? "frame" : "slice");
+
+    for (int threads = 1; threads <= max_threads; threads++) {
+        int64_t start;
+        double elapsed, fps;
+        int nb_frames;
+
+        start = av_gettime_relative();
+        ret = decode_packets(fmt_ctx->streams[stream_idx]->codecpar, pkts,
+                             nb_pkts, threads, thread_type, &nb_frames);
+        elapsed = (av_gettime_relative() - start) / 1000000.0;
+        if (ret < 0) {
+            fprintf(stderr, "Error decoding with %d threads: %s\n",
+                    threads, av_err2str(ret));
+            goto end;
+        }
+
+        fps = elapsed > 0 ? nb_frames / elapsed : 0.0;
+        if (threads == 1)
+            fps1 = fps;
+        printf("threads %2d: %d frames in %.3f s, %8.1f fps, "
+               "efficiency %5.1f%%\n", threads, nb_frames, elapsed, fps,
+               fps1 > 0 ? 100.0 * fps / (fps1 * threads) : 0.0);
+    }
+
+end:
+    for (int i = 0; i < nb_pkts; i++)
+        av_packet_free(&pkts[i]);
+    av_freep(&pkts);
+    avformat_close_input(&fmt_ctx);
+    return ret < 0;
+}